@@ -1,13 +1,34 @@
+#include <LedEngine.h>
+
+#define BLINK_LED 8
+#define BLINK_CHANNEL 0
+
+unsigned long lastReport = 0;
+
 // the setup function runs once when you press reset or power the board
 void setup() {
-  // initialize digital pin LED_BUILTIN as an output.
-  pinMode(8, OUTPUT);
+  Serial.begin(9600);
+
+  // The LED engine toggles the pin from a timer interrupt, so loop() is
+  // free to do other things without making the blink jitter
+  ledBegin();
+  ledAttach(BLINK_CHANNEL, BLINK_LED);
+  ledPattern(BLINK_CHANNEL, 10, 10);  // 10 ms on, 10 ms off
 }
 
 // the loop function runs over and over again forever
 void loop() {
-  digitalWrite(8, HIGH);  // turn the LED on (HIGH is the voltage level)
-  delay(10);                      // wait for a second
-  digitalWrite(8, LOW);   // turn the LED off by making the voltage LOW
-  delay(10);                      // wait for a second
+  if (millis() - lastReport >= 1000) {
+    lastReport = millis();
+
+    // Report how far the toggles landed from where they should have
+    int16_t minUs, maxUs;
+    ledGetJitter(BLINK_CHANNEL, &minUs, &maxUs);
+    ledResetJitter(BLINK_CHANNEL);
+
+    Serial.print(F("Toggle jitter us: min "));
+    Serial.print(minUs);
+    Serial.print(F(", max "));
+    Serial.println(maxUs);
+  }
 }
@@ -13,7 +13,23 @@
 #include <SPI.h>
 #include <Wire.h>
 #include <Adafruit_GFX.h>
-#include <Adafruit_SSD1306.h>
+#include <Adafruit_SSD1306.h>  // SSD1306_* command names
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <util/twi.h>
+#include <LedEngine.h>
+#include <FastPin.h>
+#include <TinyFmt.h>
+#include <PageCanvas.h>
+#include <SoftTimer.h>
+#include <I2cBus.h>
+#include <SerialRing.h>
+
+// The console is SerialRing's interrupt driven USART0 driver rather than
+// the core's Serial, so input keeps arriving through the blocking parts
+#define Serial Console
 
 #define RTC_I2C_ADDR 0x68
 #define SCREEN_WIDTH 128 // OLED display width, in pixels
@@ -31,7 +47,7 @@
 
 #define CHAL_MODE_LEN 1
 #define FLAG_LEN 12
-#define PIN_CODE_LEN (sizeof(unsigned long))
+#define PIN_CODE_LEN (sizeof(uint32_t))
 #define PIN_CODE_DIGITS 5
 #define HIGH_SCORE_LEN 2
 
@@ -52,15 +68,168 @@
 // 2 = Brute force via buttons
 // 3 = No brute forcing
 
-#define COMMAND_BUFFER_LEN 6
-char gCommandBuffer[COMMAND_BUFFER_LEN];
-char gCommandBufferPos = 0;
+#define COMMAND_BUFFER_LEN 12
 
-char gBgMode = 0;
-char gIsLocked = 1;
-uint8_t gChallengeMode = 0;
-uint8_t gLedTimer = 0;
-uint8_t gOldButtonStates = 0;
+// Boot stage timestamps (micros).  The stages don't run in this order (the
+// RTC is read at a different point with FAST_BOOT) and not all of them run
+// in every build, see bootMark()
+#define BOOT_STAGE_SETUP 0
+#define BOOT_STAGE_IO 1
+#define BOOT_STAGE_RTC 2
+#define BOOT_STAGE_DISPLAY 3
+#define BOOT_STAGE_SPLASH 4
+#define BOOT_STAGE_SNAKE 5
+#define BOOT_STAGE_FRAME 6
+#define NUM_BOOT_STAGES 7
+
+#define TRACE_RING_LEN 16 // must be a power of 2
+#define FLIGHT_RING_LEN 16 // must be a power of 2
+
+#define MAX_APPLES 8
+#define MAX_SNAKE_LEN 16
+
+// Profiler histogram, 2 bytes of RAM each
+#define PROF_BUCKETS 128
+
+struct TraceRecord
+{
+  uint8_t id;
+  uint16_t timeMs;
+  int16_t args[2];
+};
+
+struct FlightRecorder
+{
+  uint16_t magic;
+  uint8_t head;
+  struct TraceRecord ring[FLIGHT_RING_LEN];
+};
+
+struct Point
+{
+  int8_t x;
+  int8_t y;
+};
+
+// Everything one vault keeps in RAM.  The firmware has exactly one of
+// these; the host fleet simulator (tools/fleet_sim) runs thousands in one
+// process and points gVault at whichever one a worker thread is stepping,
+// so nothing that differs between vaults may live outside it.
+struct Vault
+{
+  // Shell
+  char commandBuffer[COMMAND_BUFFER_LEN];
+  char commandBufferPos;
+  uint8_t commandLineLost;
+
+  // Macro being played back into the shell, see shellRead()
+  uint16_t playAddr;
+  uint8_t playLeft;
+
+  // Modes and the screen
+  char bgMode;
+  char isLocked = 1;
+  uint8_t challengeMode;
+  uint8_t oldButtonStates;
+  uint8_t screenDirty = 0xff;
+  unsigned long modeFrameTime;
+  SoftTimer modeBannerTimer;
+
+  // Text read from the RTC for the frame being drawn.  The update functions
+  // fill it once per frame, the per-page draw passes only draw it.
+  char frameText[FLAG_LEN + 0x10];
+  uint8_t clock24Hr;
+  char verBuffer[32];
+
+  // Long line the current screen shows, set by its update function,
+  // see longLineSet()
+  const char* longText;
+  uint8_t longSplit;
+  uint8_t longRest;
+  uint8_t longTop;
+  uint8_t longLines;
+
+  // Display idle policy, see displayIdleService()
+  unsigned long lastActivityMs;
+  unsigned long idleFrameTime;
+  uint8_t displayIdle;
+  uint8_t displayFrameOk = 1;
+  uint8_t screenHeld;
+
+  // Unlock screen
+  uint16_t currentPinGuess;
+  uint8_t currentPinGuessPos;
+  uint8_t wrongCountdown;
+  SoftTimer wrongTimer;
+
+  // Snake
+  SoftTimer snakeAppleTimer;
+  SoftTimer snakeMoveTimer;
+  uint8_t snakeDir;
+  uint8_t snakeBufferPos;
+  uint8_t snakeLen;
+  uint16_t snakeMoveMs;
+  uint16_t snakeScore;
+  uint8_t snakeReady;
+  uint16_t snakeHighScore;
+  uint8_t snakeShowApples;
+  Point snake[MAX_SNAKE_LEN];
+
+  // Snake autopilot and what it measured, see commandSnakeStats()
+  uint8_t snakeAuto;
+  uint8_t snakeAutoPlayed;     // this game, so it can't set a high score
+  unsigned long snakeAutoStartMs;
+  unsigned long snakeTicks;
+  unsigned long snakeTickMaxUs;
+  unsigned long snakeTickTotalUs;
+  uint16_t snakeGames;
+  uint16_t snakeBestScore;
+  Point apples[MAX_APPLES];
+
+  // Diagnostics
+  struct TraceRecord traceRing[TRACE_RING_LEN];
+  uint8_t traceHead;
+  uint8_t traceTail;
+  uint16_t traceDropped;
+  unsigned long bootTimes[NUM_BOOT_STAGES];
+  uint8_t bootStagesRan;                 // bit per BOOT_STAGE_*
+  uint8_t bootOrder[NUM_BOOT_STAGES];    // stages in the order they ran
+  uint8_t bootMarks;
+  unsigned long loopMaxMs;
+  unsigned long displayPushCount;
+  unsigned long displayPushMicros;
+  unsigned long displayPushMaxMicros;
+  unsigned int displayPushErrors;
+  unsigned long displayHeldBack;
+
+  // Time spent asleep waiting for work, awake time is millis() minus this
+  unsigned long sleepMillis;
+  unsigned int sleepMicros;
+  unsigned long sleepCount;
+
+#ifdef PROFILER
+  // Sampled program counters, bucket n counts flash bytes
+  // [n << profShift, (n + 1) << profShift)
+  uint16_t profCounts[PROF_BUCKETS];
+  uint16_t profOther;
+  unsigned long profSamples;
+  uint8_t profShift;
+#endif
+
+#ifdef VAULT_HOST
+  // On a board these are the SoftTimer library's own queue and .noinit RAM
+  SoftTimerQueue timers;
+  struct FlightRecorder flight;
+  uint8_t resetCause;
+#endif
+};
+
+#ifdef VAULT_HOST
+extern thread_local struct Vault* gVaultCtx;
+#define gVault (*gVaultCtx)
+#else
+struct Vault gVault;
+#endif
 
 #define OLD_BUTTON_STATE_UP 1
 #define OLD_BUTTON_STATE_DOWN 2
@@ -69,15 +238,35 @@ uint8_t gOldButtonStates = 0;
 #define OLD_BUTTON_STATE_A 16
 #define OLD_BUTTON_STATE_B 32
 
+// Drive the SSD1306 over 4-wire SPI instead of I2C.  Hardware SPI needs
+// pins 10-13, so boards built this way have A/B on A0/A1 instead.
+//#define DISPLAY_SPI
+
 #define UP_BUTTON 3
 #define DOWN_BUTTON 4
 #define LEFT_BUTTON 5
 #define RIGHT_BUTTON 2
+#ifdef DISPLAY_SPI
+#define A_BUTTON 14
+#define B_BUTTON 15
+#else
 #define A_BUTTON 10
 #define B_BUTTON 11
+#endif
+
+// Bit order matches the OLD_BUTTON_STATE_* masks, so one read gives the
+// state of every button (pressed buttons read as 0)
+typedef FastPinGroup<UP_BUTTON, DOWN_BUTTON, LEFT_BUTTON, RIGHT_BUTTON, A_BUTTON, B_BUTTON> ButtonPins;
 #define RED_LED 9
 #define GREEN_LED 8
 
+// LED engine channels and how long the status LEDs stay lit
+#define RED_LED_CH 0
+#define GREEN_LED_CH 1
+#define LED_PIN_RESULT_MS 2000
+#define LED_APPLE_MS 200
+#define LED_GAME_OVER_MS 5000
+
 struct commandEntryStruct
 {
   char const * const commandStr;
@@ -101,11 +290,108 @@ void readDigitalButtons();
 void commandGetVersion();
 void commandGetHighScore();
 void commandSetHighScore();
+void commandGetPinsDebug();
+void commandSetChallenge();
+void commandNvDump();
+void commandNvLoad();
 void snakeInit();
+void commandBootTimes();
+void commandIdleStats();
+void commandDisplayStats();
+void commandFlightDump();
+void commandI2cStats();
+void commandSerialStats();
+void commandProfStart();
+void commandProfStop();
+void commandProfDump();
+void commandMacro();
+void commandMacros();
+void commandRun();
+void commandSnakeAuto();
+void commandSnakeStats();
+void vaultBoot();
+void vaultPass();
 
 //#define DEBUG_MODE
 //#define DEMO_MODE
 
+// Skip the splash screen, defer snake setup, and read the RTC before the
+// display comes up so kiosk boards are usable as soon as possible
+//#define FAST_BOOT
+
+// Stream trace records as binary frames instead of text, decode them on
+// the host with tools/trace_decode.py
+//#define TRACE_BINARY
+
+// Mark the loop stages in GPIOR0/GPIOR1, for a cycle accurate simulator or
+// a debugger to count the cycles between marks
+//#define BENCH_MARKS
+
+// Sampling profiler on Timer1 and the "prof start|stop|dump" commands,
+// symbolize the dump on the host with tools/prof_symbolize.py
+//#define PROFILER
+
+// Trace events: id, how to print each of the two args, message.  Call
+// sites only push a record into a ring, the text (or binary frame) goes
+// out later when the UART has room.  tools/trace_decode.py parses this
+// list, so it is the only place the messages live.
+#define TRACE_ARG_NONE 0
+#define TRACE_ARG_DEC 1
+#define TRACE_ARG_HEX 2
+#define TRACE_ARG_MODE 3
+#define TRACE_ARG_CMD 4
+#define TRACE_ARG_ADDR 5
+
+#define TRACE_EVENTS(X) \
+  X(TRACE_DROPPED,          TRACE_ARG_DEC,  TRACE_ARG_NONE, "Trace records dropped") \
+  X(TRACE_MODE_CHANGE,      TRACE_ARG_MODE, TRACE_ARG_MODE, "Mode change") \
+  X(TRACE_CLOCK_WRITE,      TRACE_ARG_HEX,  TRACE_ARG_DEC,  "clockWrite addr, bytes") \
+  X(TRACE_SNAKE_INIT,       TRACE_ARG_NONE, TRACE_ARG_NONE, "SnakeInit") \
+  X(TRACE_SNAKE_APPLE,      TRACE_ARG_DEC,  TRACE_ARG_DEC,  "Added an apple") \
+  X(TRACE_SNAKE_NO_APPLES,  TRACE_ARG_NONE, TRACE_ARG_NONE, "Too many apples!") \
+  X(TRACE_SNAKE_MOVE,       TRACE_ARG_DEC,  TRACE_ARG_DEC,  "Move the snake dir, len") \
+  X(TRACE_SNAKE_WALL,       TRACE_ARG_DEC,  TRACE_ARG_NONE, "Wall hit dir") \
+  X(TRACE_SNAKE_HIT,        TRACE_ARG_NONE, TRACE_ARG_NONE, "Snake hit") \
+  X(TRACE_SNAKE_EAT,        TRACE_ARG_DEC,  TRACE_ARG_DEC,  "Yummy!! score, len") \
+  X(TRACE_SNAKE_MAX_LEN,    TRACE_ARG_NONE, TRACE_ARG_NONE, "ANACONDA!!") \
+  X(TRACE_BOOT,             TRACE_ARG_HEX,  TRACE_ARG_NONE, "Boot, reset cause") \
+  X(TRACE_COMMAND,          TRACE_ARG_CMD,  TRACE_ARG_NONE, "Command") \
+  X(TRACE_I2C_ERROR,        TRACE_ARG_HEX,  TRACE_ARG_DEC,  "I2C error addr, code") \
+  X(TRACE_LOOP_SLOW,        TRACE_ARG_DEC,  TRACE_ARG_NONE, "Slow loop pass ms") \
+  X(TRACE_WATCHDOG,         TRACE_ARG_ADDR, TRACE_ARG_NONE, "Watchdog, stuck at") \
+  X(TRACE_DISPLAY_FAIL,     TRACE_ARG_NONE, TRACE_ARG_NONE, "Display init failed") \
+  X(TRACE_DISPLAY_IDLE,     TRACE_ARG_DEC,  TRACE_ARG_DEC,  "Display idle state, secs")
+
+#define TRACE_ENUM(id, argA, argB, msg) id,
+enum { TRACE_EVENTS(TRACE_ENUM) NUM_TRACE_EVENTS };
+
+// Loop stages: id, name.  A mark is a single OUT of the stage to GPIOR0
+// (or of the mode being drawn to GPIOR1), registers nothing else uses,
+// and without BENCH_MARKS it compiles to nothing.  Nothing in the repo
+// reads the marks yet, a tool that does should take the names from here.
+#define BENCH_STAGES(X) \
+  X(BENCH_BOOT,     "boot") \
+  X(BENCH_BUTTONS,  "buttons") \
+  X(BENCH_TIMERS,   "timers") \
+  X(BENCH_FRAME,    "frame check") \
+  X(BENCH_UPDATE,   "mode update") \
+  X(BENCH_DRAW,     "draw") \
+  X(BENCH_PUSH,     "display push") \
+  X(BENCH_SHELL,    "shell") \
+  X(BENCH_COMMAND,  "command") \
+  X(BENCH_PASS_END, "pass end")
+
+#define BENCH_ENUM(id, name) id,
+enum { BENCH_STAGES(BENCH_ENUM) NUM_BENCH_STAGES };
+
+#ifdef BENCH_MARKS
+#define BENCH_MARK(stage) (GPIOR0 = (stage))
+#define BENCH_MODE(mode) (GPIOR1 = (mode))
+#else
+#define BENCH_MARK(stage)
+#define BENCH_MODE(mode)
+#endif
+
 
 
 const struct commandEntryStruct CMD_LIST[] = {
@@ -121,12 +407,32 @@ const struct commandEntryStruct CMD_LIST[] = {
   {"getflg", commandGetFlagsDebug },
   {"geths", commandGetHighScore },
   {"seths", commandSetHighScore },
+  {"getpns", commandGetPinsDebug },
+  {"setchl", commandSetChallenge },
+  {"nvdump", commandNvDump },
+  {"nvload", commandNvLoad },
   #else
   {"nxtchl", commandNextChallenge },
   {"lock", commandLock },
   {"unlock", commandUnlock },
   {"getflg", commandGetFlags },
   #endif
+  {"boottm", commandBootTimes },
+  {"idle", commandIdleStats },
+  {"disp", commandDisplayStats },
+  {"flight", commandFlightDump },
+  {"i2c", commandI2cStats },
+  {"serial", commandSerialStats },
+  {"macro", commandMacro },
+  {"macros", commandMacros },
+  {"run", commandRun },
+  {"snauto", commandSnakeAuto },
+  {"snstat", commandSnakeStats },
+#ifdef PROFILER
+  {"prof start", commandProfStart },
+  {"prof stop", commandProfStop },
+  {"prof dump", commandProfDump },
+#endif
   {"ver", commandGetVersion }
 };
 
@@ -152,7 +458,6 @@ void snakeLeftHandler();
 void snakeRightHandler();
 void snakeAButtonHandler();
 void snakeBButtonHandler();
-void snakeBgMode();
 
 struct ButtonHandler {
   void (*upFunc)();
@@ -190,15 +495,6 @@ const struct ButtonHandler gSnakeHandlers = {
   snakeBButtonHandler
 };
 
-const struct ButtonHandler* const gButtonHandlersForMode [] = {
-  &gDefaultHandlers, // clock
-  &gUnlockHandlers, // unlock
-  &gDefaultHandlers, // version
-  &gDefaultHandlers, // flag
-  &gDefaultHandlers, // lock
-  &gSnakeHandlers, // idle
-};
-
 // Declaration for an SSD1306 display connected to I2C (SDA, SCL pins)
 // The pins for I2C are defined by the Wire-library. 
 // On an arduino UNO:       A4(SDA), A5(SCL)
@@ -206,541 +502,1664 @@ const struct ButtonHandler* const gButtonHandlersForMode [] = {
 // On an arduino LEONARDO:   2(SDA),  3(SCL), ...
 #define OLED_RESET     -1 // Reset pin # (or -1 if sharing Arduino reset pin)
 #define SCREEN_ADDRESS 0x3c ///< See datasheet for Address; 0x3D for 128x64, 0x3C for 128x32
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
 
-void setup() {
-  Serial.begin(9600);
+#ifdef DISPLAY_SPI
+#define OLED_DC 6
+#define OLED_CS 7
+#define OLED_SPI_HZ 8000000
+#endif
 
-  pinMode(UP_BUTTON, INPUT_PULLUP);
-  pinMode(DOWN_BUTTON, INPUT_PULLUP);
-  pinMode(LEFT_BUTTON, INPUT_PULLUP);
-  pinMode(RIGHT_BUTTON, INPUT_PULLUP);
-  pinMode(A_BUTTON, INPUT_PULLUP);
-  pinMode(B_BUTTON, INPUT_PULLUP);
-  pinMode(RED_LED, OUTPUT);
-  pinMode(GREEN_LED, OUTPUT);
+// The screen is drawn a page (8 rows) at a time into this instead of into a
+// 1 KB framebuffer, see displayRender().  It only holds the page being
+// drawn, so host builds give each worker thread one rather than each vault.
+#ifdef VAULT_HOST
+thread_local
+#endif
+PageCanvas display(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+// Display transport.  Modes only ever draw into the page canvas,
+// displayRender() is the one place a finished frame goes out to the panel.
+
+#define DISPLAY_CONTRAST 0xcf
+
+// Power on sequence for a 128x64 panel on the internal charge pump, the same
+// settings Adafruit_SSD1306::begin() sends
+const uint8_t display_init_cmds[] PROGMEM = {
+  SSD1306_DISPLAYOFF,
+  SSD1306_SETDISPLAYCLOCKDIV, 0x80,
+  SSD1306_SETMULTIPLEX, SCREEN_HEIGHT - 1,
+  SSD1306_SETDISPLAYOFFSET, 0x00,
+  SSD1306_SETSTARTLINE | 0x00,
+  SSD1306_CHARGEPUMP, 0x14,
+  SSD1306_MEMORYMODE, 0x00,  // horizontal addressing
+  SSD1306_SEGREMAP | 0x01,
+  SSD1306_COMSCANDEC,
+  SSD1306_SETCOMPINS, 0x12,
+  SSD1306_SETCONTRAST, DISPLAY_CONTRAST,
+  SSD1306_SETPRECHARGE, 0xf1,
+  SSD1306_SETVCOMDETECT, 0x40,
+  SSD1306_DISPLAYALLON_RESUME,
+  SSD1306_NORMALDISPLAY,
+  SSD1306_DEACTIVATE_SCROLL,
+  SSD1306_DISPLAYON
+};
 
-  // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
-  if(!display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS)) {
-    Serial.println(F("SSD1306 allocation failed"));
-    gBgMode = -1;
-    for(;;) // Don't proceed, loop forever
-    {
-        runShell(5000);
-    }
-  }
+#ifdef DISPLAY_SPI
 
-  // Board has the screen installed upside down, so rotate 180 deg
-  display.setRotation(2);
+typedef FastPin<OLED_DC> OledDcPin;
+typedef FastPin<OLED_CS> OledCsPin;
 
-  // Show initial display buffer contents on the screen --
-  // the library initializes this with an Adafruit splash screen.
-  
-  display.display();
+uint8_t displayTransportBegin()
+{
+  OledCsPin::high();
+  OledCsPin::output();
+  OledDcPin::output();
+  SPI.begin();
+  return 1;
+}
 
-  delay(50); // Pause for a bit
+void displayFrameStart()
+{
+  SPI.beginTransaction(SPISettings(OLED_SPI_HZ, MSBFIRST, SPI_MODE0));
+  OledCsPin::low();
+}
 
-  snakeInit();
-  
-  // Read the challenge mode
+void displayFrameEnd()
+{
+  OledCsPin::high();
+  SPI.endTransaction();
+}
 
-  clockRead(CHAL_MODE_ADDR, CHAL_MODE_LEN, &gChallengeMode);
-  gChallengeMode &= 0xff;
-  if ( (gChallengeMode > 3 ) )
+uint8_t displayCommands_P(const uint8_t* cmds, uint8_t len)
+{
+  displayFrameStart();
+  OledDcPin::low();
+  for(int i = 0; i < len; i++)
   {
-    Serial.println(F("Error reading version at boot"));
-    gChallengeMode = 0;
+    SPI.transfer(pgm_read_byte(&cmds[i]));
   }
+  displayFrameEnd();
+  return 1;
+}
 
-  // Clear the buffer
-  display.clearDisplay();
-  display.setTextSize(2);
-  display.setTextColor(SSD1306_WHITE);
-
-  while(1)
+uint8_t displayTransportPage(uint8_t page, const uint8_t* buf)
+{
+  OledDcPin::low();
+  SPI.transfer(SSD1306_PAGEADDR);
+  SPI.transfer(page);
+  SPI.transfer(page);
+  SPI.transfer(SSD1306_COLUMNADDR);
+  SPI.transfer(0);
+  SPI.transfer(SCREEN_WIDTH - 1);
+
+  OledDcPin::high();
+  for(int i = 0; i < SCREEN_WIDTH; i++)
   {
-    readDigitalButtons();
-    doBGTask();
-    runShell(10);
+    SPI.transfer(buf[i]);
   }
- 
+  return 1;
 }
 
+#else
+
+// The panel is happy with fast mode, but the DS1307 only does standard
+// mode, so the bus drops back down before anything talks to the RTC
+#define DISPLAY_I2C_CLOCK 400000
+#define RTC_I2C_CLOCK 100000
 
-#define MAX_BG_MODES 6
+// A byte at 400 kHz is about 360 cycles, this gives a stuck bus ~2 ms
+#define TWI_WAIT_LOOPS 5000
 
-// Show the mode name for a little while after it changes mode
-uint8_t gFreshModeChange = 0;
+#define SSD1306_CONTROL_CMDS 0x00
+#define SSD1306_CONTROL_DATA 0x40
 
-void doBGTask()
+uint8_t twiWait()
 {
-  if (gFreshModeChange)
+  uint16_t loops = TWI_WAIT_LOOPS;
+  while (!(TWCR & _BV(TWINT)))
   {
-    //Serial.print(F("freshmode = "));
-    //Serial.println(gFreshModeChange);
+    if (--loops == 0)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
 
-    // If the mode has just been changed, display the mode name for a second
-    displayChangeModes();
-    gFreshModeChange--;
-    return;
+uint8_t twiStart(uint8_t addr)
+{
+  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+  if (!twiWait() || ( (TW_STATUS != TW_START) && (TW_STATUS != TW_REP_START) ))
+  {
+    return 0;
   }
 
-  switch (gBgMode)
+  TWDR = addr << 1;
+  TWCR = _BV(TWINT) | _BV(TWEN);
+  return twiWait() && (TW_STATUS == TW_MT_SLA_ACK);
+}
+
+uint8_t twiWrite(uint8_t val)
+{
+  TWDR = val;
+  TWCR = _BV(TWINT) | _BV(TWEN);
+  return twiWait() && (TW_STATUS == TW_MT_DATA_ACK);
+}
+
+void twiStop()
+{
+  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+
+  uint16_t loops = TWI_WAIT_LOOPS;
+  while ( (TWCR & _BV(TWSTO)) && --loops )
   {
-    case 0:
-      displayClock();
-      break;
+  }
 
-    case 1:
-      displayUnlock();
-      break;
+  // Hand the peripheral back to Wire the way it expects to find it
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+}
 
-    case 2:
-      displayVersion();
-      break;
+uint8_t displayTransportBegin()
+{
+  // Wire is already running, it's shared with the RTC
+  return 1;
+}
 
-    case 3:
-      displayFlag();
-      break;
+void displayFrameStart()
+{
+  Wire.setClock(DISPLAY_I2C_CLOCK);
+}
 
-    case 4:
-      displayLock();
-      break;
-    
-    case 5:
-      snakeBgMode();
-      break;
+void displayFrameEnd()
+{
+  Wire.setClock(RTC_I2C_CLOCK);
+}
 
-    //default:
-      // Do nothing
+uint8_t displayCommands_P(const uint8_t* cmds, uint8_t len)
+{
+  displayFrameStart();
+  uint8_t ok = twiStart(SCREEN_ADDRESS) && twiWrite(SSD1306_CONTROL_CMDS);
+  for(int i = 0; ok && (i < len); i++)
+  {
+    ok = twiWrite(pgm_read_byte(&cmds[i]));
   }
+  twiStop();
+  displayFrameEnd();
+  return ok;
 }
 
-char const * const serialPrintMode(char modeVal)
+uint8_t displayTransportPage(uint8_t page, const uint8_t* buf)
 {
-  switch(modeVal)
+  // Drives the TWI registers directly so the page isn't cut into 32 byte
+  // Wire transactions, each with its own start, address and control byte.
+  // The window setup and the page data go out back to back with a repeated
+  // start between them.
+  uint8_t ok = twiStart(SCREEN_ADDRESS) && twiWrite(SSD1306_CONTROL_CMDS) &&
+               twiWrite(SSD1306_PAGEADDR) && twiWrite(page) && twiWrite(page) &&
+               twiWrite(SSD1306_COLUMNADDR) && twiWrite(0) && twiWrite(SCREEN_WIDTH - 1);
+
+  ok = ok && twiStart(SCREEN_ADDRESS) && twiWrite(SSD1306_CONTROL_DATA);
+
+  for(int i = 0; ok && (i < SCREEN_WIDTH); i++)
   {
-    case 0:
-      Serial.print(F("clock"));
-      break;
-    case 1:
-      Serial.print(F( "unlock"));
-      break;
-    case 2:
-      Serial.print(F( "version"));
-      break;
-    case 3:
-      Serial.print(F( "get flag"));
-      break;
-    case 4:
-      Serial.print(F( "lock"));
-      break;
-    default:
-      Serial.print(F( "snake"));
-      break;
+    ok = twiWrite(buf[i]);
   }
+
+  twiStop();
+  return ok;
 }
 
-const char mode_string_0[] PROGMEM = "clock";
-const char mode_string_1[] PROGMEM = "unlock";
-const char mode_string_2[] PROGMEM = "version";
-const char mode_string_3[] PROGMEM = "flag";
-const char mode_string_4[] PROGMEM = "lock";
-const char mode_string_5[] PROGMEM = "snake";
-const char* const mode_string_array[] PROGMEM = { mode_string_0, mode_string_1, mode_string_2,
-                                                  mode_string_3, mode_string_4, mode_string_5};
+#endif
 
+uint8_t displayBegin()
+{
+  return displayTransportBegin() &&
+         displayCommands_P(display_init_cmds, sizeof(display_init_cmds));
+}
 
-char const * const displayMode(char modeVal, int x, int y)
+/**
+ * Draws a whole frame and sends it to the panel.  draw is called once per
+ * page with the canvas cleared, so it has to draw the complete screen every
+ * time and must not read hardware or change state.
+ */
+void displayRender(void (*draw)())
 {
-  //char const * strmem;
-  char buf[8];
+  unsigned long start = micros();
+  uint8_t ok = 1;
 
-  if ( (modeVal >= 0) && (modeVal <= 5) )
+  displayFrameStart();
+  for(uint8_t page = 0; page < display.pageCount(); page++)
   {
-    strcpy_P(buf, (char*) pgm_read_ptr(&mode_string_array[modeVal]));
+    display.setPage(page);
+    BENCH_MARK(BENCH_DRAW);
+    draw();
+
+    BENCH_MARK(BENCH_PUSH);
+    if (!displayTransportPage(page, display.getBuffer()))
+    {
+      ok = 0;
+    }
   }
-  else
+  displayFrameEnd();
+
+  if (!ok)
   {
-      strcpy_P(buf, (char*) pgm_read_ptr(&mode_string_array[5]));
+    gVault.displayPushErrors++;
+    flight(TRACE_I2C_ERROR, SCREEN_ADDRESS, 4);
+#ifndef DISPLAY_SPI
+    // The panel shares the bus with the RTC, don't leave it wedged
+    i2cRecover();
+#endif
   }
 
-  writeString(buf, x, y);
-
+  gVault.displayPushMicros = micros() - start;
+  if (gVault.displayPushMicros > gVault.displayPushMaxMicros)
+  {
+    gVault.displayPushMaxMicros = gVault.displayPushMicros;
+  }
+  gVault.displayPushCount++;
 }
 
-void validateCurrentMode()
+// Long line: text too long for the screen at text size 2, drawn in half
+// width glyphs (6x16, 21 a line) instead.  Anything longer than a line is
+// split at a space onto a second line below.  Two lines is all there is
+// room for, so text past the end of the second line is cut and the line
+// ends in LONG_LINE_MORE to show it.  Every caller's text fits (versions
+// are under 32 characters and flag frames under FLAG_LEN + 16).
+//
+// The SSD1306's own horizontal scroll is no help here: it only rotates
+// the 128 columns it has and can't bring in anything wider than the
+// screen, so it would just move text that already fits.
+
+#define LONG_LINE_CHARS (SCREEN_WIDTH / 6)
+#define LONG_LINE_PAGES 2
+#define LONG_LINE_MORE '>'
+
+/**
+ * Makes text the current screen's long line, with its top at page
+ * topPage.  Only call it from a mode's update function, doBGTask() clears
+ * it before every update.  text has to stay put until the next update.
+ */
+void longLineSet(const char* text, uint8_t topPage)
 {
-  if (gBgMode < 0)
+  uint8_t len = strlen(text);
+  uint8_t split = len;
+  uint8_t rest = len;
+
+  if (len > LONG_LINE_CHARS)
   {
-    if (gIsLocked)
+    split = LONG_LINE_CHARS;
+    while ( (split > 0) && (text[split] != ' ') )
     {
-      gBgMode = 2;
+      split--;
     }
-    else
+    if (split == 0)
     {
-      gBgMode = MAX_BG_MODES - 1;
+      // One long word, just cut it
+      split = LONG_LINE_CHARS;
     }
-  }
 
-  if (gIsLocked)
-  {
-    gBgMode %= 3;
+    // The second line starts after the space it was split at, if any
+    rest = (text[split] == ' ') ? split + 1 : split;
   }
-  else
-  {
-    gBgMode %= MAX_BG_MODES;
-  }  
+
+  gVault.longText = text;
+  gVault.longSplit = split;
+  gVault.longRest = rest;
+  gVault.longTop = topPage;
+  gVault.longLines = (rest < len) ? 2 : 1;
 }
 
-void modeUp()
+// Draw pass part of the long line, called from the mode's draw function
+void drawLongLine()
 {
-  Serial.print(F("Old mode = "));
-  serialPrintMode(gBgMode);
-  Serial.println(F(""));
+  if (!gVault.longLines)
+  {
+    return;
+  }
 
-  gBgMode++;
+  char line[LONG_LINE_CHARS + 1];
+  const char* text = gVault.longText;
+  uint8_t y = gVault.longTop * 8;
 
-  validateCurrentMode();
+  display.setTextSize(1, 2);
 
-  Serial.print(F("New mode = "));
-  serialPrintMode(gBgMode);
-  Serial.println(F(""));
-  gFreshModeChange = 20;
+  strncpy(line, text, LONG_LINE_CHARS);
+  line[min(gVault.longSplit, LONG_LINE_CHARS)] = 0;
+  writeString(line, 0, y);
+
+  if (gVault.longLines > 1)
+  {
+    const char* second = text + gVault.longRest;
+    strncpy(line, second, LONG_LINE_CHARS);
+    line[LONG_LINE_CHARS] = 0;
+    if (strlen(second) > LONG_LINE_CHARS)
+    {
+      // Doesn't fit, say so rather than cut it quietly
+      line[LONG_LINE_CHARS - 1] = LONG_LINE_MORE;
+    }
+    writeString(line, 0, y + 8 * LONG_LINE_PAGES);
+  }
+
+  display.setTextSize(2);
 }
 
-void modeDown()
-{
-  Serial.print(F("Old mode = "));
-  serialPrintMode(gBgMode);
-  Serial.println(F(""));
+// Display idle policy.  With no button or serial input for a while the
+// screen steps down: frames at most once a second, then dimmed, then
+// switched off.  Any input brings it straight back.  Set the times with
+// a build flag, e.g. build_firmware.sh -DDISPLAY_IDLE_OFF_MS=60000UL
+#ifndef DISPLAY_IDLE_SLOW_MS
+#define DISPLAY_IDLE_SLOW_MS 60000UL
+#endif
+#ifndef DISPLAY_IDLE_DIM_MS
+#define DISPLAY_IDLE_DIM_MS 300000UL
+#endif
+#ifndef DISPLAY_IDLE_OFF_MS
+#define DISPLAY_IDLE_OFF_MS 900000UL
+#endif
 
-  gBgMode--;
+// Longest a slowed down screen goes between frames
+#define DISPLAY_IDLE_FRAME_MS 1000
 
-  validateCurrentMode();
+#define DISPLAY_AWAKE 0
+#define DISPLAY_SLOW 1
+#define DISPLAY_DIM 2
+#define DISPLAY_OFF 3
 
-  Serial.print(F("New mode = "));
-  serialPrintMode(gBgMode);
-  Serial.println(F(""));
-  gFreshModeChange = 20;
-}
+const uint8_t display_dim_cmds[] PROGMEM = { SSD1306_SETCONTRAST, 0x01 };
+const uint8_t display_bright_cmds[] PROGMEM = { SSD1306_SETCONTRAST, DISPLAY_CONTRAST };
+const uint8_t display_off_cmds[] PROGMEM = { SSD1306_DISPLAYOFF };
+const uint8_t display_on_cmds[] PROGMEM = { SSD1306_DISPLAYON };
 
+const char display_idle_0[] PROGMEM = "awake";
+const char display_idle_1[] PROGMEM = "slow";
+const char display_idle_2[] PROGMEM = "dim";
+const char display_idle_3[] PROGMEM = "off";
+const char* const display_idle_array[] PROGMEM = { display_idle_0, display_idle_1, display_idle_2, display_idle_3 };
 
-void runShell(int msForShell)
+// Called for every button press and serial byte
+void displayActivity()
 {
-  unsigned long timeoutVal = millis();
-  timeoutVal += msForShell;
-  while(millis() < timeoutVal)
+  gVault.lastActivityMs = millis();
+
+  if (gVault.displayIdle == DISPLAY_AWAKE)
   {
-    if (Serial.available())
-    {
-      unsigned char nb = Serial.read();
-      Serial.print( (char) nb);
-      if ( (nb == '\n') || (nb == '\r') )
-      {
-        interpretCommand();
-      }
-      else
-      {
-        if (gCommandBufferPos < COMMAND_BUFFER_LEN)
-        {
-          gCommandBuffer[gCommandBufferPos++] = nb;
-        }
-      }
-    }
-    delay(1);
+    return;
+  }
+
+  if (gVault.displayIdle >= DISPLAY_DIM)
+  {
+    displayCommands_P(display_bright_cmds, sizeof(display_bright_cmds));
+  }
+  if (gVault.displayIdle == DISPLAY_OFF)
+  {
+    displayCommands_P(display_on_cmds, sizeof(display_on_cmds));
   }
+
+  trace(TRACE_DISPLAY_IDLE, DISPLAY_AWAKE, 0);
+  gVault.displayIdle = DISPLAY_AWAKE;
+  gVault.displayFrameOk = 1;
+
+  // Whatever changed while it was held back goes out on this pass
+  invalidateScreen(gVault.screenHeld);
+  gVault.screenHeld = 0;
 }
 
-void interpretCommand()
+// Once a pass before doBGTask(), steps the screen down as the idle time
+// passes each limit and decides whether this pass may send a frame
+void displayIdleService()
 {
-  // Echo the command
-  Serial.print(F("Command Receive: "));
-  for(int i = 0; i < gCommandBufferPos; i++)
+  unsigned long idleMs = millis() - gVault.lastActivityMs;
+
+  uint8_t state = DISPLAY_AWAKE;
+  if (idleMs >= DISPLAY_IDLE_OFF_MS)
   {
-    Serial.write(gCommandBuffer[i]);
+    state = DISPLAY_OFF;
   }
-  Serial.println(F(""));
-
-  unsigned char cmdMatchFound = 0;
-  for(int i = 0; i < NUM_CMDS; i++)
+  else if (idleMs >= DISPLAY_IDLE_DIM_MS)
   {
-    int curListCmdLen = strlen(CMD_LIST[i].commandStr);
-    if (curListCmdLen != gCommandBufferPos)
-    {
-      // Commands isn't the same length
-      // Serial.print(F("Command "));
-      // Serial.print(CMD_LIST[i].commandStr);
-      // Serial.println(F(" not match due to lenght mismatch"));
-      continue;
-    }
+    state = DISPLAY_DIM;
+  }
+  else if (idleMs >= DISPLAY_IDLE_SLOW_MS)
+  {
+    state = DISPLAY_SLOW;
+  }
 
-    if (memcmp(CMD_LIST[i].commandStr, gCommandBuffer, curListCmdLen) == 0)
+  // Only ever steps down here, displayActivity() does the waking
+  if (state > gVault.displayIdle)
+  {
+    if ( (state >= DISPLAY_DIM) && (gVault.displayIdle < DISPLAY_DIM) )
     {
-      //Serial.println(F("Found mathcing command!"));
-      CMD_LIST[i].handler();
-      cmdMatchFound = 1;
-      break;
+      displayCommands_P(display_dim_cmds, sizeof(display_dim_cmds));
     }
-    else
+    if (state == DISPLAY_OFF)
     {
-      // Commands isn't the same length
-      // Serial.print(F("Command "));
-      // Serial.print(CMD_LIST[i].commandStr);
-      // Serial.println(F(" not match due to compare fail"));
+      displayCommands_P(display_off_cmds, sizeof(display_off_cmds));
     }
 
+    trace(TRACE_DISPLAY_IDLE, state, idleMs / 1000);
+    gVault.displayIdle = state;
   }
 
-  memset(gCommandBuffer, 0, COMMAND_BUFFER_LEN);
-  gCommandBufferPos = 0;
-
-  if (!cmdMatchFound)
+  if (gVault.displayIdle == DISPLAY_AWAKE)
   {
-    Serial.println(F("No matching handler found for command"));
+    gVault.displayFrameOk = 1;
+  }
+  else if (gVault.displayIdle == DISPLAY_OFF)
+  {
+    gVault.displayFrameOk = 0;
+  }
+  else
+  {
+    gVault.displayFrameOk = (millis() - gVault.idleFrameTime >= DISPLAY_IDLE_FRAME_MS);
+    if (gVault.displayFrameOk && gVault.screenHeld)
+    {
+      invalidateScreen(gVault.screenHeld);
+      gVault.screenHeld = 0;
+    }
   }
 }
 
-void commandHelp()
+void commandDisplayStats()
 {
-  Serial.println(F("Command List:"));
-
-  for(int i = 0; i < NUM_CMDS; i++)
-  {
-    Serial.print(F(" "));
-    Serial.println(CMD_LIST[i].commandStr);
-  }
+  Serial.print(F("Frames pushed: "));
+  Serial.println(gVault.displayPushCount);
+  Serial.print(F("Last push us: "));
+  Serial.println(gVault.displayPushMicros);
+  Serial.print(F("Max push us: "));
+  Serial.println(gVault.displayPushMaxMicros);
+  Serial.print(F("Push errors: "));
+  Serial.println(gVault.displayPushErrors);
+  Serial.print(F("Frames held back: "));
+  Serial.println(gVault.displayHeldBack);
+  Serial.print(F("Idle: "));
+  Serial.print( (const __FlashStringHelper*) pgm_read_ptr(&display_idle_array[gVault.displayIdle]) );
+  Serial.print(F(", "));
+  Serial.print( (millis() - gVault.lastActivityMs) / 1000 );
+  Serial.println(F(" s since input"));
+}
 
-  if (gBgMode == -1)
+const char boot_stage_0[] PROGMEM = "setup";
+const char boot_stage_1[] PROGMEM = "io";
+const char boot_stage_2[] PROGMEM = "rtc";
+const char boot_stage_3[] PROGMEM = "display";
+const char boot_stage_4[] PROGMEM = "splash";
+const char boot_stage_5[] PROGMEM = "snake";
+const char boot_stage_6[] PROGMEM = "frame";
+const char* const boot_stage_array[] PROGMEM = { boot_stage_0, boot_stage_1, boot_stage_2, boot_stage_3,
+                                                 boot_stage_4, boot_stage_5, boot_stage_6 };
+
+// micros() can read 0 this early, so which stages ran is kept apart from
+// their times
+void bootMark(uint8_t stage)
+{
+  gVault.bootTimes[stage] = micros();
+  if ( !(gVault.bootStagesRan & _BV(stage)) && (gVault.bootMarks < NUM_BOOT_STAGES) )
   {
-    Serial.println(F("Initialization failed for display!"));
+    gVault.bootOrder[gVault.bootMarks++] = stage;
   }
+  gVault.bootStagesRan |= _BV(stage);
 }
 
-void commandSecs(void)
+void bootStagePrint(uint8_t stage)
 {
-  Serial.println(F("Secs Handler"));
-  unsigned char numSecs;
-  unsigned char br = clockRead(0, 1, &numSecs);
+  char buf[8];
+  strcpy_P(buf, (char*) pgm_read_ptr(&boot_stage_array[stage]));
+  Serial.print(F(" "));
+  Serial.print(buf);
+  Serial.print(F(": "));
 }
 
-void commandMins(void)
+void commandBootTimes()
 {
-  Serial.println(F("Mins Handler"));
+  Serial.println(F("Boot stage times (us):"));
 
-  Wire.beginTransmission(0x68);
-  Wire.write(0x01);
-  Wire.endTransmission();
-
-  int br = Wire.requestFrom(0x68, 1);
+  // In the order they ran, so each delta is the time that stage took
+  unsigned long prevTime = gVault.bootTimes[BOOT_STAGE_SETUP];
+  for(int i = 0; i < gVault.bootMarks; i++)
+  {
+    uint8_t stage = gVault.bootOrder[i];
+    bootStagePrint(stage);
+    Serial.print(gVault.bootTimes[stage]);
+    Serial.print(F(" (+"));
+    Serial.print(gVault.bootTimes[stage] - prevTime);
+    Serial.println(F(")"));
+    prevTime = gVault.bootTimes[stage];
+  }
 
-  for(int i = 0; i < br; i++)
+  for(int i = 0; i < NUM_BOOT_STAGES; i++)
   {
-    if (Wire.available() == 0)
+    if ( !(gVault.bootStagesRan & _BV(i)) )
     {
-      Serial.print(F("Error. read "));
-      Serial.print(br);
-      Serial.print(F(" bytes, but only "));
-      Serial.print(i);
-      Serial.println(F(" available"));
-      break;
+      bootStagePrint(i);
+      Serial.println(F("skipped"));
     }
-
-    unsigned char curChar = Wire.read();
-    Serial.print(F("Read: "));
-    hexPrint(curChar);
-    Serial.println(F(""));
   }
-
 }
 
-void commandStart()
+void readChallengeMode()
 {
-  Serial.println(F("Start Handler"));
+  clockRead(CHAL_MODE_ADDR, CHAL_MODE_LEN, &gVault.challengeMode);
+  gVault.challengeMode &= 0xff;
+  if ( (gVault.challengeMode > 3 ) )
+  {
+    Serial.println(F("Error reading version at boot"));
+    gVault.challengeMode = 0;
+  }
+}
+
+void setup() {
+  vaultBoot();
 
-  Wire.beginTransmission(0x68);
-  Wire.write(0x00);
-  Wire.write(0x44);
-  Wire.endTransmission();
+  while(1)
+  {
+    vaultPass();
+  }
 }
 
-void allRegHandler()
+void vaultBoot()
 {
-  Serial.println(F("All Regs Handler"));
-  unsigned char regVals[8];
-  unsigned char br = clockRead(0, 8, regVals);
-}
+  BENCH_MARK(BENCH_BOOT);
+  bootMark(BOOT_STAGE_SETUP);
 
-void commandSetTime()
-{
-  Serial.println(F("Set Time Handler"));
+  Serial.begin(9600);
+  flightBoot();
 
-  Serial.println(F("Enter the time as HHMMSS, HHMMSSa, or HHMMSSp"));
+  ButtonPins::inputPullup();
+  ledBegin();
+  ledAttach(RED_LED_CH, RED_LED);
+  ledAttach(GREEN_LED_CH, GREEN_LED);
+  enableButtonWake();
 
-  unsigned char timeBuf[8];
-  int br = readString(8, timeBuf, 60);  
+  bootMark(BOOT_STAGE_IO);
 
-  Serial.print(F("Bytes read = "));
-  Serial.println(br);
+#ifdef FAST_BOOT
+  // Read the challenge mode while the panel is still settling from power on,
+  // then bring the display up without having it restart Wire
+  i2cBegin();
+  readChallengeMode();
+  bootMark(BOOT_STAGE_RTC);
 
-  if ( (br != 6) && (br != 7) )
-  {
-      Serial.println(F("Time val must be 6/7 chars long"));
-      return;
-  }
+  bool displayOk = displayBegin();
+#else
+  i2cBegin();
+  bool displayOk = displayBegin();
+#endif
 
-  // Validate HH
-  if ( (timeBuf[0] < '0') || (timeBuf[0] > '2') || (timeBuf[1] < '0') || (timeBuf[1] > '9') )
-  {
-    Serial.println(F("Invalid HH value"));
+  if(!displayOk) {
+    Serial.println(F("SSD1306 not responding"));
+    flight(TRACE_DISPLAY_FAIL, 0, 0);
+    gVault.bgMode = -1;
     return;
   }
 
-  // Validate MM
-  if ( (timeBuf[2] < '0') || (timeBuf[2] > '5') || (timeBuf[3] < '0') || (timeBuf[3] > '9') )
+  bootMark(BOOT_STAGE_DISPLAY);
+
+  // Board has the screen installed upside down, so rotate 180 deg
+  display.setRotation(2);
+  display.setTextSize(2);
+  display.setTextColor(SSD1306_WHITE);
+
+#ifndef FAST_BOOT
+  // Wipe whatever the panel RAM powered up with
+  displayRender(drawBlank);
+
+  delay(50); // Pause for a bit
+  bootMark(BOOT_STAGE_SPLASH);
+
+  snakeInit();
+  bootMark(BOOT_STAGE_SNAKE);
+  
+  // Read the challenge mode
+  readChallengeMode();
+  bootMark(BOOT_STAGE_RTC);
+#endif
+
+  modeEnter(gVault.bgMode);
+  doBGTask();
+  bootMark(BOOT_STAGE_FRAME);
+}
+
+// One pass of the main loop
+void vaultPass()
+{
+  if (gVault.bgMode == -1)
   {
-    Serial.println(F("Invalid MM value"));
+    // Display failed at boot, don't proceed, just run the shell
+    runShell(5000);
     return;
   }
 
-  // Validate SS
-  if ( (timeBuf[4] < '0') || (timeBuf[4] > '2') || (timeBuf[5] < '0') || (timeBuf[5] > '9') )
+  unsigned long passStart = millis();
+
+  BENCH_MARK(BENCH_BUTTONS);
+  readDigitalButtons();
+  BENCH_MARK(BENCH_TIMERS);
+  timerService();
+  displayIdleService();
+  doBGTask();
+  runShell(10);
+
+  loopPassDone(passStart);
+}
+
+
+// Show the mode name for a little while after it changes mode
+#define MODE_BANNER_MS 1000
+
+// Region of the screen the mode name banner draws over
+#define BANNER_X 4
+#define BANNER_Y 16
+#define BANNER_W (SCREEN_WIDTH - 8)
+#define BANNER_H 24
+
+// Inputs a screen's content depends on.  Static screens are only redrawn
+// when one of their inputs has been invalidated since the last render.
+#define SCREEN_INPUT_MODE 1       // gVault.bgMode changed
+#define SCREEN_INPUT_CHALLENGE 2  // gVault.challengeMode changed
+#define SCREEN_INPUT_FLAGS 4      // flags in the RTC RAM rewritten
+#define SCREEN_INPUT_LOCK 8       // gVault.isLocked changed
+#define SCREEN_INPUT_BANNER 16    // mode banner shown or removed
+#define SCREEN_INPUT_GAME 32      // snake moved or an apple appeared
+#define SCREEN_INPUT_LIVE 128     // redraw every pass (animated screens)
+
+#define SCREEN_INPUTS_STATIC (SCREEN_INPUT_MODE | SCREEN_INPUT_BANNER)
+
+// Every background mode, in the order the buttons cycle through them.
+//   num     - value of gVault.bgMode
+//   name    - shown on the mode banner and by the shell
+//   locked  - reachable while the vault is locked
+//   buttons - ButtonHandler used while the mode is showing
+//   enter / exit - run when the mode becomes / stops being the active one
+//   update  - once per frame before drawing, reads hardware / moves state on
+//   draw    - once per page, see displayRender()
+//   inputs  - SCREEN_INPUT_* the screen depends on
+//   ms      - live modes only, minimum time between frames
+#define BG_MODES(X) \
+  X(0, "clock",   1, gDefaultHandlers, modeNop,    modeNop, clockUpdate, displayClock,       SCREEN_INPUT_LIVE, 100) \
+  X(1, "unlock",  1, gUnlockHandlers,  modeNop,    modeNop, modeNop,     displayUnlock,      SCREEN_INPUT_LIVE, 0) \
+  X(2, "version", 1, gDefaultHandlers, modeNop,    modeNop, versionUpdate, displayVersion,     SCREEN_INPUTS_STATIC | SCREEN_INPUT_CHALLENGE, 0) \
+  X(3, "flag",    0, gDefaultHandlers, modeNop,    modeNop, flagUpdate,  displayFlag,        SCREEN_INPUTS_STATIC | SCREEN_INPUT_CHALLENGE | SCREEN_INPUT_FLAGS, 0) \
+  X(4, "lock",    0, gDefaultHandlers, lockEnter,  modeNop, modeNop,     displayLock,        SCREEN_INPUTS_STATIC | SCREEN_INPUT_LOCK, 0) \
+  X(5, "snake",   0, gSnakeHandlers,   snakeEnter, snakeExit, modeNop,   snakeRedrawDisplay, SCREEN_INPUTS_STATIC | SCREEN_INPUT_GAME, 0)
+
+#define BG_MODE_COUNT(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) + 1
+#define BG_MODE_STRING(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) const char mode_string_##num[] PROGMEM = name;
+#define BG_MODE_STRING_PTR(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) mode_string_##num,
+#define BG_MODE_LOCKED(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) locked,
+#define BG_MODE_BUTTONS(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) &buttons,
+#define BG_MODE_INPUTS(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) inputs,
+#define BG_MODE_MS(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) ms,
+#define BG_MODE_CALL_ENTER(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) case num: enter(); break;
+#define BG_MODE_CALL_EXIT(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) case num: exit(); break;
+#define BG_MODE_CALL_UPDATE(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) case num: update(); break;
+#define BG_MODE_CALL_DRAW(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) case num: draw(); break;
+
+#define BG_MODE_NUMBER(num, name, locked, buttons, enter, exit, update, draw, inputs, ms) BG_MODE_DRAWN_BY_##draw = num,
+
+#define NUM_BG_MODES (0 BG_MODES(BG_MODE_COUNT))
+
+// Mode numbers by draw function, every mode has its own, for code that
+// needs to name a particular mode: BG_MODE_DRAWN_BY_displayFlag
+enum { BG_MODES(BG_MODE_NUMBER) };
+
+BG_MODES(BG_MODE_STRING)
+const char* const mode_string_array[] PROGMEM = { BG_MODES(BG_MODE_STRING_PTR) };
+
+const uint8_t gModeAllowedLocked [] = { BG_MODES(BG_MODE_LOCKED) };
+const struct ButtonHandler* const gButtonHandlersForMode [] = { BG_MODES(BG_MODE_BUTTONS) };
+const uint8_t gScreenInputsForMode [] = { BG_MODES(BG_MODE_INPUTS) };
+const uint16_t gFrameMsForMode [] = { BG_MODES(BG_MODE_MS) };
+
+// The hooks are called through switches rather than function pointer
+// tables so they're direct calls the compiler can inline
+void modeEnter(char mode)
+{
+  switch (mode)
   {
-    Serial.println(F("Invalid SS value"));
-    return;
+    BG_MODES(BG_MODE_CALL_ENTER)
   }
+}
 
-  if (br == 7)
+void modeExit(char mode)
+{
+  switch (mode)
   {
-    if ( (timeBuf[6] != 'a') && (timeBuf[6] != 'p') )
-    {
-      Serial.println(F("Invalid a/p value"));
-      return;
-    }
+    BG_MODES(BG_MODE_CALL_EXIT)
   }
+}
 
-  unsigned regVal;
-  regVal = ( (timeBuf[0] - '0') << 4 );
-  regVal &= 0x30;
-  regVal |= ( (timeBuf[1] - '0') & 0x0f );
+void modeUpdate(char mode)
+{
+  switch (mode)
+  {
+    BG_MODES(BG_MODE_CALL_UPDATE)
+  }
+}
 
-  // special hour bits
-  if (br == 6)
+void modeDraw(char mode)
+{
+  switch (mode)
   {
-    // Set 24 hour mode
-    regVal |= 0x40;
+    BG_MODES(BG_MODE_CALL_DRAW)
   }
-  else
+}
+
+void modeNop()
+{
+}
+
+void invalidateScreen(uint8_t inputs)
+{
+  gVault.screenDirty |= inputs;
+}
+
+void showModeBanner()
+{
+  timerOnce(&gVault.modeBannerTimer, MODE_BANNER_MS, modeBannerDone);
+  invalidateScreen(SCREEN_INPUT_MODE | SCREEN_INPUT_BANNER);
+}
+
+void modeBannerDone()
+{
+  // Static screens need to repaint the area the banner was covering
+  invalidateScreen(SCREEN_INPUT_BANNER);
+}
+
+uint8_t modeBannerUp()
+{
+  return timerArmed(&gVault.modeBannerTimer);
+}
+
+void doBGTask()
+{
+  BENCH_MARK(BENCH_FRAME);
+  BENCH_MODE(gVault.bgMode);
+
+  uint8_t inputs = gScreenInputsForMode[gVault.bgMode];
+  uint8_t due = gVault.screenDirty & (inputs | SCREEN_INPUTS_STATIC);
+  if ( (inputs & SCREEN_INPUT_LIVE) && (millis() - gVault.modeFrameTime >= gFrameMsForMode[gVault.bgMode]) )
   {
-    if (timeBuf[6] == 'p')
-    {
-      regVal |= 0x20;
-    }
+    due = 1;
   }
 
-  if (clockWrite(2, 1, (unsigned char*) &regVal))
+  if (!due)
   {
-    Serial.println(F("Error writing hours for clock"));
+    // Nothing this screen shows has changed, skip the render and the flush
     return;
   }
-  
-  regVal = ( (timeBuf[2] - '0') << 4 );
-  regVal &= 0x70;
-  regVal |= ( (timeBuf[3] - '0') & 0x0f );
+  gVault.screenDirty = 0;
+  gVault.modeFrameTime = millis();
 
-  if (clockWrite(1, 1, (unsigned char*) &regVal))
+  if (!gVault.displayFrameOk)
   {
-    Serial.println(F("Error writing minutes for clock"));
+    // Nobody is looking.  Count the frame we didn't send, and keep what it
+    // would have shown for the next one that does go out.
+    gVault.screenHeld |= due;
+    gVault.displayHeldBack++;
     return;
   }
+  gVault.idleFrameTime = millis();
 
-  regVal = ( (timeBuf[4] - '0') << 4 );
-  regVal &= 0x70;
-  regVal |= ( (timeBuf[5] - '0') & 0x0f );
+  // Only the update below can put a long line on the new frame
+  gVault.longLines = 0;
 
-  if (clockWrite(0, 1, (unsigned char*) &regVal))
+  // Anything that talks to the RTC or moves the game along happens once
+  // here, the draw passes below only draw
+  BENCH_MARK(BENCH_UPDATE);
+  modeUpdate(gVault.bgMode);
+
+  displayRender(drawBGFrame);
+}
+
+void drawBlank()
+{
+}
+
+void drawBGFrame()
+{
+  // The active mode always draws, the banner (if any) is composited over
+  // the top of it
+  modeDraw(gVault.bgMode);
+
+  if (modeBannerUp())
   {
-    Serial.println(F("Error writing minutes for clock"));
-    return;
+    // If the mode has just been changed, display the mode name for a second
+    displayChangeModes();
   }
+}
 
-  Serial.println(F("Set Time handler complete"));
+// Mode names are shared by the serial shell and the screen
+const char* getModeString(char modeVal)
+{
+  if ( (modeVal < 0) || (modeVal >= NUM_BG_MODES) )
+  {
+    modeVal = NUM_BG_MODES - 1;
+  }
+
+  return (const char*) pgm_read_ptr(&mode_string_array[modeVal]);
 }
 
+void serialPrintMode(char modeVal)
+{
+  Serial.print( (const __FlashStringHelper*) getModeString(modeVal) );
+}
 
+void displayMode(char modeVal, int x, int y)
+{
+  char buf[8];
+  strcpy_P(buf, getModeString(modeVal));
+  writeString(buf, x, y);
+}
 
-void writeFlag(int flagNum)
+uint8_t modeAllowed(char mode)
 {
-  Serial.println(F("Give me a flag to write (don't include wildcat or curly braces)"));
-  char flag[FLAG_LEN+1];
-  memset(flag, 0, FLAG_LEN+1);
+  return !gVault.isLocked || gModeAllowedLocked[mode];
+}
 
-  int bytesRead = readString(FLAG_LEN, flag, 30);
-  if (bytesRead == -1)
+char nextAllowedMode(char mode, char step)
+{
+  // Clock is allowed locked or not, so this always finds one
+  do
   {
-    Serial.println(F("Timeout reading flag from user"));
+    mode += step;
+    if (mode < 0)
+    {
+      mode = NUM_BG_MODES - 1;
+    }
+    else if (mode >= NUM_BG_MODES)
+    {
+      mode = 0;
+    }
+  } while (!modeAllowed(mode));
+
+  return mode;
+}
+
+void setBgMode(char newMode)
+{
+  char oldMode = gVault.bgMode;
+
+  modeExit(oldMode);
+  gVault.bgMode = newMode;
+  modeEnter(newMode);
+
+  trace(TRACE_MODE_CHANGE, oldMode, gVault.bgMode);
+  showModeBanner();
+}
+
+void modeUp()
+{
+  setBgMode(nextAllowedMode(gVault.bgMode, 1));
+}
+
+void modeDown()
+{
+  setBgMode(nextAllowedMode(gVault.bgMode, -1));
+}
+
+#define TRACE_SYNC 0xa5
+
+#ifdef TRACE_BINARY
+#define TRACE_DRAIN_ROOM ((int) (1 + sizeof(struct TraceRecord)))
+#else
+#define TRACE_DRAIN_ROOM 40
+#endif
+
+#define TRACE_STRING(id, argA, argB, msg) const char id##_msg[] PROGMEM = msg;
+#define TRACE_STRING_PTR(id, argA, argB, msg) id##_msg,
+#define TRACE_ARG_KINDS(id, argA, argB, msg) (argA) | ((argB) << 4),
+
+TRACE_EVENTS(TRACE_STRING)
+const char* const trace_string_array[] PROGMEM = { TRACE_EVENTS(TRACE_STRING_PTR) };
+const uint8_t trace_arg_array[] PROGMEM = { TRACE_EVENTS(TRACE_ARG_KINDS) };
+
+void trace(uint8_t id, int16_t argA, int16_t argB)
+{
+  if ( (uint8_t) (gVault.traceHead - gVault.traceTail) >= TRACE_RING_LEN )
+  {
+    gVault.traceDropped++;
     return;
   }
 
-  Serial.print(F("Writing flag "));
-  Serial.print(flagNum);
-  Serial.print(F(": wildcat{"));
-  Serial.print(flag);
-  Serial.println(F("}"));
+  struct TraceRecord* rec = gVault.traceRing + (gVault.traceHead & (TRACE_RING_LEN - 1));
+  rec->id = id;
+  rec->timeMs = millis();
+  rec->args[0] = argA;
+  rec->args[1] = argB;
+  gVault.traceHead++;
+}
 
-  flagNum %= 3;
-  int addr = FLAG_0_ADDR;
-  addr += (FLAG_LEN + PIN_CODE_LEN) * flagNum;
-  clockWrite(addr, FLAG_LEN, flag);
+void traceEmit(struct TraceRecord const * rec)
+{
+#ifdef TRACE_BINARY
+  Serial.write(TRACE_SYNC);
+  Serial.write( (uint8_t const *) rec, sizeof(struct TraceRecord));
+#else
+  Serial.print( (const __FlashStringHelper*) pgm_read_ptr(&trace_string_array[rec->id]) );
 
-  Serial.println(F("Done"));
+  uint8_t argKinds = pgm_read_byte(&trace_arg_array[rec->id]);
+  for(int i = 0; i < 2; i++)
+  {
+    switch(argKinds & 0xf)
+    {
+      case TRACE_ARG_DEC:
+        Serial.print(F(" "));
+        Serial.print(rec->args[i]);
+        break;
+      case TRACE_ARG_HEX:
+        Serial.print(F(" "));
+        hexPrint(rec->args[i]);
+        break;
+      case TRACE_ARG_MODE:
+        Serial.print(F(" "));
+        serialPrintMode(rec->args[i]);
+        break;
+      case TRACE_ARG_CMD:
+        Serial.print(F(" "));
+        if ( (rec->args[i] >= 0) && (rec->args[i] < (int16_t) NUM_CMDS) )
+        {
+          Serial.print(CMD_LIST[rec->args[i]].commandStr);
+        }
+        break;
+      case TRACE_ARG_ADDR:
+        Serial.print(F(" "));
+        hexPrint(rec->args[i] >> 8);
+        hexPrint(rec->args[i]);
+        break;
+    }
+    argKinds >>= 4;
+  }
+  Serial.println(F(""));
+#endif
 }
 
-void commandSetFlags()
+// Called when the loop is idle, only sends what fits in the TX buffer
+void traceDrain()
 {
-  for(int i = 0; i < 3; i++)
+  while (gVault.traceTail != gVault.traceHead)
   {
-    writeFlag(i);
+    if (Serial.availableForWrite() < TRACE_DRAIN_ROOM)
+    {
+      return;
+    }
+
+    traceEmit(gVault.traceRing + (gVault.traceTail & (TRACE_RING_LEN - 1)));
+    gVault.traceTail++;
+  }
+
+  if (gVault.traceDropped && (Serial.availableForWrite() >= TRACE_DRAIN_ROOM))
+  {
+    struct TraceRecord rec;
+    rec.id = TRACE_DROPPED;
+    rec.timeMs = millis();
+    rec.args[0] = gVault.traceDropped;
+    rec.args[1] = 0;
+    traceEmit(&rec);
+    gVault.traceDropped = 0;
   }
 }
 
-// Hide this in the shared source
-#ifdef DEMO_MODE
-const char flag_4[] PROGMEM = "s4mpl3-flg4";
+// Flight recorder.  The last few important events, kept in RAM that the C
+// runtime doesn't clear at startup so they survive a watchdog or reset
+// button reset and can be dumped with the "flight" command afterwards.
+#define FLIGHT_MAGIC 0xf17e
+
+// A loop pass that takes longer than this is recorded
+#define LOOP_SLOW_MS 250
+
+// A loop pass that takes longer than this trips the watchdog.  The first
+// timeout records where the loop was stuck, the second resets the board.
+#define LOOP_BUDGET WDTO_2S
+
+#ifdef VAULT_HOST
+#define gFlight (gVault.flight)
+#define gResetCause (gVault.resetCause)
 #else
-const char flag_4[] PROGMEM = "********";
+struct FlightRecorder gFlight __attribute__((section(".noinit")));
+
+// MCUSR is copied out and cleared before main(), so a watchdog reset
+// doesn't leave the watchdog running through the bootloader and setup()
+uint8_t gResetCause __attribute__((section(".noinit")));
+
+void saveResetCause() __attribute__((naked, used, section(".init3")));
+void saveResetCause()
+{
+  gResetCause = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
 #endif
-void getFlag(int flagNum, char* flagBuf)
+
+void flightRecord(uint8_t id, int16_t argA, int16_t argB)
 {
-  if (flagNum >= 3)
+  struct TraceRecord* rec = gFlight.ring + (gFlight.head & (FLIGHT_RING_LEN - 1));
+  rec->id = id;
+  rec->timeMs = millis();
+  rec->args[0] = argA;
+  rec->args[1] = argB;
+  gFlight.head++;
+}
+
+// Traced like any other event, and also kept in the flight recorder
+void flight(uint8_t id, int16_t argA, int16_t argB)
+{
+  flightRecord(id, argA, argB);
+  trace(id, argA, argB);
+}
+
+void flightBoot()
+{
+  if (gFlight.magic != FLIGHT_MAGIC)
   {
-    strcpy_P(flagBuf, flag_4);
-    return;
+    // Power on, the RAM is garbage
+    memset(&gFlight, 0, sizeof(gFlight));
+    gFlight.magic = FLIGHT_MAGIC;
   }
 
-  flagNum %= 3;
-  memset(flagBuf, 0, FLAG_LEN+1);
+  flight(TRACE_BOOT, gResetCause, 0);
 
-  int addr = FLAG_0_ADDR;
-  addr += (FLAG_LEN + PIN_CODE_LEN) * flagNum;
+  wdt_enable(LOOP_BUDGET);
+  WDTCSR |= _BV(WDIE);
+}
 
-  clockRead(addr, FLAG_LEN, flagBuf);
+ISR(WDT_vect)
+{
+  // First timeout of a stuck loop, the next one resets.  Records the byte
+  // address we were interrupted at, ready for avr-addr2line.
+  flightRecord(TRACE_WATCHDOG, (uintptr_t) __builtin_return_address(0) * 2, 0);
 }
 
-void getFlagMyChalMode(char* flagBuf)
+void loopPassDone(unsigned long passStartMs)
+{
+  BENCH_MARK(BENCH_PASS_END);
+  wdt_reset();
+
+  // The hardware clears WDIE when the interrupt fires, so after a pass
+  // that overran once it has to be set again, or the next hang resets
+  // with nothing in the flight recorder.  WDIE alone doesn't need WDCE.
+  WDTCSR |= _BV(WDIE);
+
+  unsigned long passMs = millis() - passStartMs;
+  if (passMs > gVault.loopMaxMs)
+  {
+    gVault.loopMaxMs = passMs;
+  }
+
+  if (passMs > LOOP_SLOW_MS)
+  {
+    flight(TRACE_LOOP_SLOW, passMs, 0);
+  }
+}
+
+// delay() for waits long enough to trip the watchdog
+void watchdogDelay(unsigned long ms)
 {
-  getFlag(gChallengeMode, flagBuf);
+  while (ms > 100)
+  {
+    wdt_reset();
+    delay(100);
+    ms -= 100;
+  }
+  wdt_reset();
+  delay(ms);
 }
 
-void printFlagToSerial(int flagNum)
+void commandFlightDump()
 {
-  char flag[FLAG_LEN+1];
-  getFlag(flagNum, flag);
+  Serial.print(F("Reset cause: "));
+  hexPrint(gResetCause);
+  Serial.println(F(""));
+  Serial.print(F("Slowest loop ms: "));
+  Serial.println(gVault.loopMaxMs);
 
-  // Need to make sure we have a null terminator before printing
-  for(int i = 0; i < FLAG_LEN; i++)
+  // Oldest first.  Times are millis() at the time, so they restart at
+  // every boot record.
+  for(uint8_t i = 0; i < FLIGHT_RING_LEN; i++)
   {
-    if (flag[i] == 0)
+    struct TraceRecord* rec = gFlight.ring + ( (gFlight.head + i) & (FLIGHT_RING_LEN - 1) );
+    if ( (rec->id == TRACE_DROPPED) || (rec->id >= NUM_TRACE_EVENTS) )
+    {
+      // Unused slot
+      continue;
+    }
+
+    Serial.print(rec->timeMs);
+    Serial.print(F(" "));
+    traceEmit(rec);
+  }
+}
+
+#ifdef PROFILER
+// Samples a second.  Prime, so it never lines up with the 1024 us millis()
+// tick or anything the loop does on a whole number of ms.
+#define PROF_HZ 997
+
+// End of the code and PROGMEM data, from the linker script
+extern char _etext;
+
+ISR(TIMER1_COMPA_vect)
+{
+  // Word address we interrupted, same as the watchdog records
+  uint16_t pc = (uintptr_t) __builtin_return_address(0);
+  uint16_t bucket = pc >> (gVault.profShift - 1);
+
+  if (bucket < PROF_BUCKETS)
+  {
+    if (gVault.profCounts[bucket] != 0xffff)
+    {
+      gVault.profCounts[bucket]++;
+    }
+  }
+  else if (gVault.profOther != 0xffff)
+  {
+    gVault.profOther++;
+  }
+  gVault.profSamples++;
+}
+
+void commandProfStart()
+{
+  TIMSK1 &= ~_BV(OCIE1A);
+
+  // Spread the buckets over just the code there is
+  gVault.profShift = 1;
+  while ( ( (uintptr_t) &_etext >> gVault.profShift ) >= PROF_BUCKETS )
+  {
+    gVault.profShift++;
+  }
+  memset(gVault.profCounts, 0, sizeof(gVault.profCounts));
+  gVault.profOther = 0;
+  gVault.profSamples = 0;
+
+  // CTC, clk/8
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11);
+  OCR1A = (F_CPU / 8 / PROF_HZ) - 1;
+  TCNT1 = 0;
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+
+  Serial.print(F("Profiling, "));
+  Serial.print(1 << gVault.profShift);
+  Serial.println(F(" byte buckets"));
+}
+
+void commandProfStop()
+{
+  TIMSK1 &= ~_BV(OCIE1A);
+  TCCR1B = 0;
+
+  Serial.print(F("Stopped after "));
+  Serial.print(gVault.profSamples);
+  Serial.println(F(" samples"));
+}
+
+// Lines tools/prof_symbolize.py reads: "Prof <first byte addr> <count>"
+void commandProfDump()
+{
+  // Don't sample ourselves printing, and don't print a moving target
+  uint8_t running = TIMSK1 & _BV(OCIE1A);
+  TIMSK1 &= ~_BV(OCIE1A);
+
+  Serial.print(F("Prof samples "));
+  Serial.println(gVault.profSamples);
+  Serial.print(F("Prof hz "));
+  Serial.println(PROF_HZ);
+  Serial.print(F("Prof bucket "));
+  Serial.println(1 << gVault.profShift);
+
+  for(uint8_t i = 0; i < PROF_BUCKETS; i++)
+  {
+    if (gVault.profCounts[i] == 0)
+    {
+      continue;
+    }
+
+    Serial.print(F("Prof "));
+    uint16_t addr = (uint16_t) i << gVault.profShift;
+    hexPrint(addr >> 8);
+    hexPrint(addr);
+    Serial.print(F(" "));
+    Serial.println(gVault.profCounts[i]);
+  }
+
+  Serial.print(F("Prof other "));
+  Serial.println(gVault.profOther);
+
+  TIMSK1 |= running;
+}
+#endif
+
+// Pin change interrupts on the buttons only exist to wake us from sleep,
+// the buttons themselves are still polled by readDigitalButtons
+EMPTY_INTERRUPT(PCINT0_vect);
+EMPTY_INTERRUPT(PCINT1_vect);
+EMPTY_INTERRUPT(PCINT2_vect);
+
+void enableButtonWake()
+{
+  const uint8_t buttonPins[] = { UP_BUTTON, DOWN_BUTTON, LEFT_BUTTON, RIGHT_BUTTON, A_BUTTON, B_BUTTON };
+
+  for(uint8_t i = 0; i < sizeof(buttonPins); i++)
+  {
+    *digitalPinToPCMSK(buttonPins[i]) |= _BV(digitalPinToPCMSKbit(buttonPins[i]));
+    PCICR |= _BV(digitalPinToPCICRbit(buttonPins[i]));
+  }
+}
+
+void idleSleep()
+{
+  // Any interrupt wakes us: the millis() tick, a serial byte, or a button
+  // edge, so nothing is ever waiting longer than it did with delay(1)
+  unsigned long sleepStart = micros();
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+
+  gVault.sleepMicros += micros() - sleepStart;
+  while (gVault.sleepMicros >= 1000)
+  {
+    gVault.sleepMicros -= 1000;
+    gVault.sleepMillis++;
+  }
+  gVault.sleepCount++;
+}
+
+void commandIdleStats()
+{
+  unsigned long totalMs = millis();
+  unsigned long awakeMs = totalMs - gVault.sleepMillis;
+
+  Serial.print(F("Asleep ms: "));
+  Serial.println(gVault.sleepMillis);
+  Serial.print(F("Awake ms: "));
+  Serial.println(awakeMs);
+  Serial.print(F("Wakeups: "));
+  Serial.println(gVault.sleepCount);
+
+  if (totalMs >= 100)
+  {
+    Serial.print(F("Load: "));
+    Serial.print(awakeMs / (totalMs / 100));
+    Serial.println(F("%"));
+  }
+}
+
+// Runs for msForShell, and past that until every complete line that was
+// already waiting has been run, and any macro has played out, so a pasted
+// script that piled up during a blocking section doesn't trickle out one
+// command per loop pass.  That catching up stops after SHELL_DRAIN_MS and
+// carries on next pass, a long backlog would otherwise keep one pass going
+// past the watchdog's LOOP_BUDGET.
+//
+// Several commands can go on one line with ; between them.  The receive
+// ring is the queue: the rest of the line keeps arriving into it while
+// the first command runs.
+#define SHELL_DRAIN_MS 500
+
+void runShell(int msForShell)
+{
+  BENCH_MARK(BENCH_SHELL);
+  unsigned long start = millis();
+  uint8_t linesWaiting = serialLines();
+  while (1)
+  {
+    unsigned long ranMs = millis() - start;
+    if ( (ranMs >= (unsigned long) msForShell) &&
+         ( !(linesWaiting || gVault.playLeft) || (ranMs >= SHELL_DRAIN_MS) ) )
+    {
+      break;
+    }
+
+    if (shellAvailable())
+    {
+      uint8_t fromMacro = gVault.playLeft;
+      unsigned char nb = shellRead();
+      displayActivity();
+      if (nb == SERIAL_LINE_LOST)
+      {
+        // Bytes went missing, whatever is assembled so far is wrong
+        Serial.print(F(" <line lost, input overflow>"));
+        memset(gVault.commandBuffer, 0, COMMAND_BUFFER_LEN);
+        gVault.commandBufferPos = 0;
+        gVault.commandLineLost = 1;
+        continue;
+      }
+
+      Serial.print( (char) nb);
+      if ( (nb == '\n') || (nb == '\r') || (nb == ';') )
+      {
+        if (linesWaiting && (nb != ';') && !fromMacro)
+        {
+          linesWaiting--;
+        }
+
+        if (gVault.commandLineLost)
+        {
+          gVault.commandLineLost = 0;
+        }
+        else if ( (nb != ';') || gVault.commandBufferPos )
+        {
+          interpretCommand();
+          BENCH_MARK(BENCH_SHELL);
+
+          // Each command is progress, so a run of them (pasted lines, a
+          // macro) isn't taken for a hang
+          wdt_reset();
+        }
+      }
+      else if ( (nb == ' ') && (gVault.commandBufferPos == 0) )
+      {
+        // "a; b" as well as "a;b", interpretCommand() drops trailing spaces
+      }
+      else
+      {
+        if (gVault.commandBufferPos < COMMAND_BUFFER_LEN)
+        {
+          gVault.commandBuffer[gVault.commandBufferPos++] = nb;
+        }
+      }
+    }
+    else
+    {
+      // Anything counted that isn't here was read by a command's prompt
+      linesWaiting = 0;
+
+      // Shell only loops (display failed) have no loop pass to feed it
+      wdt_reset();
+      traceDrain();
+      idleSleep();
+    }
+  }
+}
+
+void interpretCommand()
+{
+  BENCH_MARK(BENCH_COMMAND);
+
+  // "a ;b" as well as "a;b"
+  while ( (gVault.commandBufferPos > 0) && (gVault.commandBuffer[gVault.commandBufferPos - 1] == ' ') )
+  {
+    gVault.commandBuffer[--gVault.commandBufferPos] = 0;
+  }
+
+  // Echo the command
+  Serial.print(F("Command Receive: "));
+  for(int i = 0; i < gVault.commandBufferPos; i++)
+  {
+    Serial.write(gVault.commandBuffer[i]);
+  }
+  Serial.println(F(""));
+
+  unsigned char cmdMatchFound = 0;
+  for(unsigned int i = 0; i < NUM_CMDS; i++)
+  {
+    int curListCmdLen = strlen(CMD_LIST[i].commandStr);
+    if (curListCmdLen != gVault.commandBufferPos)
+    {
+      // Commands isn't the same length
+      // Serial.print(F("Command "));
+      // Serial.print(CMD_LIST[i].commandStr);
+      // Serial.println(F(" not match due to lenght mismatch"));
+      continue;
+    }
+
+    if (memcmp(CMD_LIST[i].commandStr, gVault.commandBuffer, curListCmdLen) == 0)
+    {
+      //Serial.println(F("Found mathcing command!"));
+      flight(TRACE_COMMAND, i, 0);
+      CMD_LIST[i].handler();
+      cmdMatchFound = 1;
+      break;
+    }
+    else
+    {
+      // Commands isn't the same length
+      // Serial.print(F("Command "));
+      // Serial.print(CMD_LIST[i].commandStr);
+      // Serial.println(F(" not match due to compare fail"));
+    }
+
+  }
+
+  memset(gVault.commandBuffer, 0, COMMAND_BUFFER_LEN);
+  gVault.commandBufferPos = 0;
+
+  if (!cmdMatchFound)
+  {
+    Serial.println(F("No matching handler found for command"));
+  }
+}
+
+void commandHelp()
+{
+  Serial.println(F("Command List:"));
+
+  for(unsigned int i = 0; i < NUM_CMDS; i++)
+  {
+    Serial.print(F(" "));
+    Serial.println(CMD_LIST[i].commandStr);
+  }
+
+  if (gVault.bgMode == -1)
+  {
+    Serial.println(F("Initialization failed for display!"));
+  }
+}
+
+void commandSecs(void)
+{
+  Serial.println(F("Secs Handler"));
+  unsigned char numSecs;
+  unsigned char br = clockRead(0, 1, &numSecs);
+}
+
+void commandMins(void)
+{
+  Serial.println(F("Mins Handler"));
+
+  unsigned char curChar;
+  uint8_t err = i2cRead(RTC_I2C_ADDR, 0x01, &curChar, 1);
+  if (err)
+  {
+    i2cPrintError(err);
+    return;
+  }
+
+  Serial.print(F("Read: "));
+  hexPrint(curChar);
+  Serial.println(F(""));
+}
+
+void commandStart()
+{
+  Serial.println(F("Start Handler"));
+
+  unsigned char regVal = 0x44;
+  i2cWrite(RTC_I2C_ADDR, 0x00, &regVal, 1);
+}
+
+void allRegHandler()
+{
+  Serial.println(F("All Regs Handler"));
+  unsigned char regVals[8];
+  unsigned char br = clockRead(0, 8, regVals);
+}
+
+void commandSetTime()
+{
+  Serial.println(F("Set Time Handler"));
+
+  Serial.println(F("Enter the time as HHMMSS, HHMMSSa, or HHMMSSp"));
+
+  unsigned char timeBuf[8];
+  int br = readString(8, (char*) timeBuf, 60);  
+
+  Serial.print(F("Bytes read = "));
+  Serial.println(br);
+
+  if ( (br != 6) && (br != 7) )
+  {
+      Serial.println(F("Time val must be 6/7 chars long"));
+      return;
+  }
+
+  // Validate HH
+  if ( (timeBuf[0] < '0') || (timeBuf[0] > '2') || (timeBuf[1] < '0') || (timeBuf[1] > '9') )
+  {
+    Serial.println(F("Invalid HH value"));
+    return;
+  }
+
+  // Validate MM
+  if ( (timeBuf[2] < '0') || (timeBuf[2] > '5') || (timeBuf[3] < '0') || (timeBuf[3] > '9') )
+  {
+    Serial.println(F("Invalid MM value"));
+    return;
+  }
+
+  // Validate SS
+  if ( (timeBuf[4] < '0') || (timeBuf[4] > '2') || (timeBuf[5] < '0') || (timeBuf[5] > '9') )
+  {
+    Serial.println(F("Invalid SS value"));
+    return;
+  }
+
+  if (br == 7)
+  {
+    if ( (timeBuf[6] != 'a') && (timeBuf[6] != 'p') )
+    {
+      Serial.println(F("Invalid a/p value"));
+      return;
+    }
+  }
+
+  unsigned regVal;
+  regVal = ( (timeBuf[0] - '0') << 4 );
+  regVal &= 0x30;
+  regVal |= ( (timeBuf[1] - '0') & 0x0f );
+
+  // special hour bits
+  if (br == 6)
+  {
+    // Set 24 hour mode
+    regVal |= 0x40;
+  }
+  else
+  {
+    if (timeBuf[6] == 'p')
+    {
+      regVal |= 0x20;
+    }
+  }
+
+  if (clockWrite(2, 1, (unsigned char*) &regVal))
+  {
+    Serial.println(F("Error writing hours for clock"));
+    return;
+  }
+  
+  regVal = ( (timeBuf[2] - '0') << 4 );
+  regVal &= 0x70;
+  regVal |= ( (timeBuf[3] - '0') & 0x0f );
+
+  if (clockWrite(1, 1, (unsigned char*) &regVal))
+  {
+    Serial.println(F("Error writing minutes for clock"));
+    return;
+  }
+
+  regVal = ( (timeBuf[4] - '0') << 4 );
+  regVal &= 0x70;
+  regVal |= ( (timeBuf[5] - '0') & 0x0f );
+
+  if (clockWrite(0, 1, (unsigned char*) &regVal))
+  {
+    Serial.println(F("Error writing minutes for clock"));
+    return;
+  }
+
+  Serial.println(F("Set Time handler complete"));
+}
+
+
+
+void writeFlag(int flagNum)
+{
+  Serial.println(F("Give me a flag to write (don't include wildcat or curly braces)"));
+  char flag[FLAG_LEN+1];
+  memset(flag, 0, FLAG_LEN+1);
+
+  int bytesRead = readString(FLAG_LEN, flag, 30);
+  if (bytesRead == -1)
+  {
+    Serial.println(F("Timeout reading flag from user"));
+    return;
+  }
+
+  Serial.print(F("Writing flag "));
+  Serial.print(flagNum);
+  Serial.print(F(": wildcat{"));
+  Serial.print(flag);
+  Serial.println(F("}"));
+
+  flagNum %= 3;
+  int addr = FLAG_0_ADDR;
+  addr += (FLAG_LEN + PIN_CODE_LEN) * flagNum;
+  clockWrite(addr, FLAG_LEN, (unsigned char*) flag);
+  invalidateScreen(SCREEN_INPUT_FLAGS);
+
+  Serial.println(F("Done"));
+}
+
+void commandSetFlags()
+{
+  for(int i = 0; i < 3; i++)
+  {
+    writeFlag(i);
+  }
+}
+
+// Hide this in the shared source
+#ifdef DEMO_MODE
+const char flag_4[] PROGMEM = "s4mpl3-flg4";
+#else
+const char flag_4[] PROGMEM = "********";
+#endif
+void getFlag(int flagNum, char* flagBuf)
+{
+  if (flagNum >= 3)
+  {
+    strcpy_P(flagBuf, flag_4);
+    return;
+  }
+
+  flagNum %= 3;
+  memset(flagBuf, 0, FLAG_LEN+1);
+
+  int addr = FLAG_0_ADDR;
+  addr += (FLAG_LEN + PIN_CODE_LEN) * flagNum;
+
+  clockRead(addr, FLAG_LEN, (unsigned char*) flagBuf);
+}
+
+void getFlagMyChalMode(char* flagBuf)
+{
+  getFlag(gVault.challengeMode, flagBuf);
+}
+
+void printFlagToSerial(int flagNum)
+{
+  char flag[FLAG_LEN+1];
+  getFlag(flagNum, flag);
+
+  // Need to make sure we have a null terminator before printing
+  for(int i = 0; i < FLAG_LEN; i++)
+  {
+    if (flag[i] == 0)
     {
       // Found null terminator, print flag
       Serial.print(F("Flag "));
@@ -752,228 +2171,667 @@ void printFlagToSerial(int flagNum)
     }
 }
 
-Serial.println(F("Error. Flag data lacks null terminator"));
+Serial.println(F("Error. Flag data lacks null terminator"));
+}
+
+void commandGetFlagsDebug()
+{
+  printFlagToSerial(0);
+  printFlagToSerial(1);
+  printFlagToSerial(2);
+  printFlagToSerial(3);
+}
+
+void commandGetFlags()
+{
+  if (gVault.isLocked == 0)
+  {
+    printFlagToSerial(gVault.challengeMode);
+  }
+  else
+  {
+    Serial.println(F("Must unlock device first!"));
+  }
+}
+
+
+uint32_t readPinFromRam(int pinStoreNum)
+{
+  uint32_t retVal;
+  pinStoreNum %= 4;
+  int addr = PIN_CODE_0_ADDR + (PIN_CODE_LEN + FLAG_LEN) * pinStoreNum;
+
+  if (clockRead(addr, sizeof(uint32_t), (unsigned char*) &retVal) != sizeof(uint32_t))
+  {
+    Serial.println(F("Error reading the pin code"));
+    retVal = -1;
+  }
+  else
+  {
+    // If somehow large pin goes in, unlock is only uint16_t
+    retVal &= 0xffff;
+
+    // Can't make this challenge that easy!
+    //Serial.print(F("Read pin "));
+    //Serial.print(retVal);
+    //Serial.println(F(" from external RAM"));
+  }
+
+  return retVal;
+}
+
+void writePinToRam(int pinStoreNum, uint32_t pinVal)
+{
+  pinStoreNum %= 4;
+  int addr = PIN_CODE_0_ADDR + (PIN_CODE_LEN + FLAG_LEN) * pinStoreNum;
+
+  if (clockWrite(addr, sizeof(uint32_t), (unsigned char*) &pinVal) != 0)
+  {
+    Serial.println(F("Error save the pin code"));
+  }
+  else
+  {
+    Serial.print(F("Wrote pin "));
+    Serial.print(pinVal);
+    Serial.println(F(" to external RAM"));
+  }
+}
+
+void setPin(int pinNum)
+{
+  char pinCode[PIN_CODE_DIGITS + 1];
+  memset(pinCode, 0, PIN_CODE_DIGITS+1);
+
+  Serial.println(F("Give me a pin to write (no mor than 5 digits)"));
+
+  int br = readString(PIN_CODE_DIGITS + 1, pinCode, 30);
+  if (br == -1)
+  {
+    Serial.println(F("Timeout waiting for pin code"));
+    return;
+  }
+
+  if ( (br < 3) || (br > 5) )
+  {
+    Serial.print(F("Invalid pin length of "));
+    Serial.println(br);
+    return;
+  }
+
+  // Validate the pin code
+  for(unsigned int i = 0; i < PIN_CODE_LEN; i++)
+  {
+    if ( (pinCode[i] < '0') || (pinCode[i] > '9') )
+    {
+      Serial.println(F("Pin code is invalid"));
+      return;
+    }
+  }
+
+  unsigned long pinRaw = parseDec(pinCode);
+
+  Serial.print(F("Writing pin #"));
+  Serial.print(pinNum);
+  Serial.print(F(" as "));
+  Serial.println(pinRaw);
+
+  writePinToRam(pinNum, pinRaw);
+}
+
+void commandSetPins()
+{
+  for(int i = 0; i < 4; i++)
+  {
+    setPin(i);
+  }
+}
+
+// Lets provisioning tools read back what wrpins wrote
+void commandGetPinsDebug()
+{
+  for(int i = 0; i < 4; i++)
+  {
+    // Read first, challenge 0 dumps every RTC read to serial and it
+    // mustn't land in the middle of the line
+    uint32_t pinVal = readPinFromRam(i);
+
+    Serial.print(F("Pin "));
+    Serial.print(i);
+    Serial.print(F(": "));
+    Serial.println(pinVal);
+  }
+}
+
+void commandSetChallenge()
+{
+  Serial.println(F("Give me a challenge mode (0-3)"));
+
+  char buf[2];
+  int br = readString(2, buf, 30);
+  if ( (br != 1) || (buf[0] < '0') || (buf[0] > '3') )
+  {
+    Serial.println(F("Invalid challenge mode"));
+    return;
+  }
+
+  gVault.challengeMode = buf[0] - '0';
+  clockWrite(CHAL_MODE_ADDR, CHAL_MODE_LEN, &gVault.challengeMode);
+  gVault.isLocked = 1;
+  invalidateScreen(SCREEN_INPUT_CHALLENGE | SCREEN_INPUT_LOCK);
+
+  Serial.print(F("Challenge mode set to "));
+  Serial.println(gVault.challengeMode);
+}
+
+const char ver_string_0[] PROGMEM = "Flag via serial CLI";
+const char ver_string_1[] PROGMEM = "Flag via serial pin brute force";
+const char ver_string_2[] PROGMEM = "Flag via button brute force";
+const char ver_string_3[] PROGMEM = "Flag via hardware monitoring";
+
+const char* const ver_string_array[] PROGMEM = {ver_string_0, ver_string_1, ver_string_2, ver_string_3};
+
+char const * const getVersionString(int verNum)
+{
+  verNum %= 4;
+  strcpy_P(gVault.verBuffer, (char*) pgm_read_ptr(&ver_string_array[verNum]));
+  return gVault.verBuffer;
+}
+
+void commandGetVersion()
+{
+#ifdef DEBUG_MODE
+  Serial.print(F("DEBUG! "));
+#else
+  Serial.print(F("Version: "));
+#endif
+
+  Serial.println(gVault.challengeMode);
+  Serial.println(getVersionString(gVault.challengeMode));
+
+}
+
+void commandNextChallenge()
+{
+  if (gVault.bgMode == 3)
+  {
+    Serial.println(F("Can't be on flag screen!"));
+    return;
+  }
+
+  Serial.println(F("You really want to goto next challenge?"));
+  Serial.println(F("Type yes to confirm"));
+
+  char buf[4];
+  int num_chars = readString(4, buf, 30);
+  Serial.println(F(""));
+
+  if (num_chars != 3)
+    return;
+
+  if ( (buf[0] != 'y') || (buf[1] != 'e' ) || (buf[2] != 's') )
+    return;
+
+  gVault.challengeMode += 1;
+  if (gVault.challengeMode == 4)
+    gVault.challengeMode = 0;
+
+  Serial.println(F("Mode changed to "));
+
+  Serial.println(gVault.challengeMode);
+  Serial.println(getVersionString(gVault.challengeMode));
+
+  clockWrite(CHAL_MODE_ADDR, CHAL_MODE_LEN, &gVault.challengeMode);
+  gVault.isLocked = 1;
+  invalidateScreen(SCREEN_INPUT_CHALLENGE | SCREEN_INPUT_LOCK);
+}
+
+void commandLock()
+{
+  Serial.println(F("Locking!"));
+  gVault.isLocked = 1;
+  invalidateScreen(SCREEN_INPUT_LOCK);
+}
+
+void commandUnlock()
+{
+  char pinCode[PIN_CODE_DIGITS + 1];
+  memset(pinCode, 0, PIN_CODE_DIGITS+1);
+
+  Serial.println(F("Enter the pin (no mor than 5 digits)"));
+
+  int br = readString(PIN_CODE_DIGITS + 1, pinCode, 30);
+  if (br == -1)
+  {
+    Serial.println(F("Timeout waiting for pin code"));
+    return;
+  }
+
+  unsigned long pinRaw = parseDec(pinCode);
+
+  uint32_t expectedPin = readPinFromRam(gVault.challengeMode);
+  Serial.println(F(""));
+
+  if (pinRaw == expectedPin)
+  {
+    Serial.println(F("PIN ACCEPTED!"));
+    gVault.isLocked = 0;
+    invalidateScreen(SCREEN_INPUT_LOCK);
+  }
+  else
+  {
+    Serial.print(F("PIN "));
+    Serial.print(pinRaw);
+    Serial.println(F(" INVALID"));
+
+    if (gVault.challengeMode >= 2)
+    {
+      Serial.println(F("Brute force guard!  Wait 5 seconds"));
+      watchdogDelay(5000);
+      Serial.println(F("You can try again now!"));
+    }
+  }
+
+}
+
+// The whole battery backed RAM region, mode through high score
+#define NV_ADDR CHAL_MODE_ADDR
+#define NV_LEN (0x40 - NV_ADDR)
+
+// Wire's buffer holds 32 bytes, and a write needs one of them for the
+// register address
+#define NV_READ_CHUNK BUFFER_LENGTH
+#define NV_WRITE_CHUNK (BUFFER_LENGTH - 1)
+
+// "NV " + 2 hex chars per byte + " " + 4 hex chars of CRC
+#define NV_LINE_LEN (3 + NV_LEN * 2 + 1 + 4)
+
+uint8_t nvRead(uint8_t* nv)
+{
+  for(int pos = 0; pos < NV_LEN; pos += NV_READ_CHUNK)
+  {
+    uint8_t len = min(NV_LEN - pos, NV_READ_CHUNK);
+    if (clockRead(NV_ADDR + pos, len, nv + pos) != len)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint8_t nvWrite(uint8_t* nv)
+{
+  for(int pos = 0; pos < NV_LEN; pos += NV_WRITE_CHUNK)
+  {
+    uint8_t len = min(NV_LEN - pos, NV_WRITE_CHUNK);
+    if (clockWrite(NV_ADDR + pos, len, nv + pos))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint16_t nvCrc(uint8_t const * nv)
+{
+  uint16_t crc = 0;
+  for(int i = 0; i < NV_LEN; i++)
+  {
+    crc = _crc_xmodem_update(crc, nv[i]);
+  }
+  return crc;
+}
+
+void commandNvDump()
+{
+  uint8_t nv[NV_LEN];
+  if (!nvRead(nv))
+  {
+    Serial.println(F("Error reading NVRAM"));
+    return;
+  }
+
+  uint16_t crc = nvCrc(nv);
+
+  Serial.print(F("NV "));
+  for(int i = 0; i < NV_LEN; i++)
+  {
+    hexPrint(nv[i]);
+  }
+  Serial.print(F(" "));
+  hexPrint(crc >> 8);
+  hexPrint(crc & 0xff);
+  Serial.println(F(""));
+}
+
+void commandNvLoad()
+{
+  Serial.println(F("Paste an nvdump line"));
+
+  char line[NV_LINE_LEN + 2];
+  int br = readString(NV_LINE_LEN + 2, line, 30);
+  Serial.println(F(""));
+  if ( (br != NV_LINE_LEN) || (memcmp(line, "NV ", 3) != 0) || (line[3 + NV_LEN * 2] != ' ') )
+  {
+    Serial.println(F("Not an nvdump line"));
+    return;
+  }
+
+  uint8_t nv[NV_LEN];
+  for(int i = 0; i < NV_LEN; i++)
+  {
+    int16_t val = parseHex8(line + 3 + i * 2);
+    if (val < 0)
+    {
+      Serial.println(F("Bad hex in nvdump line"));
+      return;
+    }
+    nv[i] = val;
+  }
+
+  int16_t crcHi = parseHex8(line + 3 + NV_LEN * 2 + 1);
+  int16_t crcLo = parseHex8(line + 3 + NV_LEN * 2 + 3);
+  if ( (crcHi < 0) || (crcLo < 0) || (nvCrc(nv) != (uint16_t) ((crcHi << 8) | crcLo)) )
+  {
+    Serial.println(F("Checksum mismatch, nothing written"));
+    return;
+  }
+
+  if ( (nv[0] > 3) || !nvWrite(nv) )
+  {
+    Serial.println(F("Error writing NVRAM"));
+    return;
+  }
+
+  // Read it back so a bad bus doesn't look like a successful clone
+  uint8_t check[NV_LEN];
+  if (!nvRead(check) || (memcmp(nv, check, NV_LEN) != 0))
+  {
+    Serial.println(F("NVRAM verify failed"));
+    return;
+  }
+
+  gVault.challengeMode = nv[0];
+  gVault.isLocked = 1;
+  invalidateScreen(SCREEN_INPUT_CHALLENGE | SCREEN_INPUT_FLAGS | SCREEN_INPUT_LOCK);
+  Serial.println(F("NVRAM loaded"));
+}
+
+// Shell macros: a name for a line of ; separated commands (prompt answers
+// included), kept in the ATmega's EEPROM since the RTC RAM is full.
+// The area starts with MACRO_MAGIC and the format version.  Anything else
+// there, erased EEPROM or another sketch's data, reads as no macros; the
+// header is written along with the first macro saved.  After it, records
+// are packed back to back: a length byte, the name and its 0, then the
+// commands with no terminator.  A length of 0xff ends the list.
+#define MACRO_EE_ADDR 0
+#define MACRO_EE_LEN 512
+#define MACRO_MAGIC 0x4d
+#define MACRO_VERSION 1
+#define MACRO_LIST_ADDR (MACRO_EE_ADDR + 2)
+#define MACRO_LIST_END (MACRO_EE_ADDR + MACRO_EE_LEN)
+#define MACRO_NAME_LEN 8
+#define MACRO_BODY_LEN 80
+#define MACRO_END 0xff
+
+uint8_t macroByte(uint16_t addr)
+{
+  return eeprom_read_byte( (const uint8_t*) (uintptr_t) addr );
+}
+
+void macroPut(uint16_t addr, uint8_t val)
+{
+  // Only writes bytes that change, EEPROM cells wear out
+  eeprom_update_byte( (uint8_t*) (uintptr_t) addr, val );
 }
 
-void commandGetFlagsDebug()
+uint8_t macroHeaderValid()
 {
-  printFlagToSerial(0);
-  printFlagToSerial(1);
-  printFlagToSerial(2);
-  printFlagToSerial(3);
+  return (macroByte(MACRO_EE_ADDR) == MACRO_MAGIC) && (macroByte(MACRO_EE_ADDR + 1) == MACRO_VERSION);
 }
 
-void commandGetFlags()
+uint8_t macroNameMatches(uint16_t rec, const char* name)
 {
-  if (gIsLocked == 0)
-  {
-    printFlagToSerial(gChallengeMode);
-  }
-  else
+  for(uint8_t i = 0; ; i++)
   {
-    Serial.println(F("Must unlock device first!"));
+    uint8_t c = macroByte(rec + 1 + i);
+    if (c != (uint8_t) name[i])
+    {
+      return 0;
+    }
+    if (c == 0)
+    {
+      return 1;
+    }
   }
 }
 
-
-uint32_t readPinFromRam(int pinStoreNum)
+/**
+ * Walks the records looking for name (or just to the end with name null).
+ * Returns the record's address, or where the list ends if there's no such
+ * macro.  A record that runs off the end of the area ends the list too.
+ */
+uint16_t macroFind(const char* name)
 {
-  uint32_t retVal;
-  pinStoreNum %= 4;
-  int addr = PIN_CODE_0_ADDR + (PIN_CODE_LEN + FLAG_LEN) * pinStoreNum;
-
-  if (clockRead(addr, sizeof(uint32_t), (unsigned char*) &retVal) != sizeof(uint32_t))
+  uint16_t rec = MACRO_LIST_ADDR;
+  if (!macroHeaderValid())
   {
-    Serial.println(F("Error reading the pin code"));
-    retVal = -1;
+    return rec;
   }
-  else
+  while (rec < MACRO_LIST_END)
   {
-    // If somehow large pin goes in, unlock is only uint16_t
-    retVal &= 0xffff;
-
-    // Can't make this challenge that easy!
-    //Serial.print(F("Read pin "));
-    //Serial.print(retVal);
-    //Serial.println(F(" from external RAM"));
+    uint8_t len = macroByte(rec);
+    if ( (len == MACRO_END) || (rec + 1 + len > MACRO_LIST_END) )
+    {
+      break;
+    }
+    if (name && macroNameMatches(rec, name))
+    {
+      return rec;
+    }
+    rec += 1 + len;
   }
-
-  return retVal;
+  return rec;
 }
 
-void writePinToRam(int pinStoreNum, uint32_t pinVal)
+uint8_t macroExists(uint16_t rec)
 {
-  pinStoreNum %= 4;
-  int addr = PIN_CODE_0_ADDR + (PIN_CODE_LEN + FLAG_LEN) * pinStoreNum;
+  return macroHeaderValid() && (rec < MACRO_LIST_END) && (macroByte(rec) != MACRO_END);
+}
 
-  if (clockWrite(addr, sizeof(uint32_t), (unsigned char*) &pinVal) != 0)
-  {
-    Serial.println(F("Error save the pin code"));
-  }
-  else
+void macroDelete(uint16_t rec)
+{
+  // Slide everything after it down so the free space stays in one piece
+  uint16_t end = macroFind(NULL);
+  uint16_t from = rec + 1 + macroByte(rec);
+  while (from < end)
   {
-    Serial.print(F("Wrote pin "));
-    Serial.print(pinVal);
-    Serial.println(F(" to external RAM"));
+    macroPut(rec++, macroByte(from++));
   }
+  macroPut(rec, MACRO_END);
 }
 
-void setPin(int pinNum)
+uint8_t macroAdd(const char* name, const char* body)
 {
-  char pinCode[PIN_CODE_DIGITS + 1];
-  memset(pinCode, 0, PIN_CODE_DIGITS+1);
+  uint8_t nameLen = strlen(name);
+  uint8_t bodyLen = strlen(body);
+  uint16_t rec = macroFind(NULL);
 
-  Serial.println(F("Give me a pin to write (no mor than 5 digits)"));
-
-  int br = readString(PIN_CODE_DIGITS + 1, pinCode, 30);
-  if (br == -1)
+  // Room for the record and the end marker after it
+  if (rec + 1 + nameLen + 1 + bodyLen + 1 > MACRO_LIST_END)
   {
-    Serial.println(F("Timeout waiting for pin code"));
-    return;
+    return 0;
   }
 
-  if ( (br < 3) || (br > 5) )
+  if (!macroHeaderValid())
   {
-    Serial.print(F("Invalid pin length of "));
-    Serial.println(br);
-    return;
+    // An empty list first, and the magic last, so a reset partway through
+    // leaves the area still reading as not ours
+    macroPut(MACRO_LIST_ADDR, MACRO_END);
+    macroPut(MACRO_EE_ADDR + 1, MACRO_VERSION);
+    macroPut(MACRO_EE_ADDR, MACRO_MAGIC);
   }
 
-  // Validate the pin code
-  for(int i = 0; i < PIN_CODE_LEN; i++)
+  macroPut(rec++, nameLen + 1 + bodyLen);
+  for(uint8_t i = 0; i <= nameLen; i++)
   {
-    if ( (pinCode[i] < '0') || (pinCode[i] > '9') )
-    {
-      Serial.println(F("Pin code is invalid"));
-      return;
-    }
+    macroPut(rec++, name[i]);
   }
-
-  unsigned long pinRaw = strtoul(pinCode, 0, 10);
-
-  Serial.print(F("Writing pin #"));
-  Serial.print(pinNum);
-  Serial.print(F(" as "));
-  Serial.println(pinRaw);
-
-  writePinToRam(pinNum, pinRaw);
-}
-
-void commandSetPins()
-{
-  for(int i = 0; i < 4; i++)
+  for(uint8_t i = 0; i < bodyLen; i++)
   {
-    setPin(i);
+    macroPut(rec++, body[i]);
   }
+  macroPut(rec, MACRO_END);
+  return 1;
 }
 
-const char ver_string_0[] PROGMEM = "Flag via serial CLI";
-const char ver_string_1[] PROGMEM = "Flag via serial pin brute force";
-const char ver_string_2[] PROGMEM = "Flag via button brute force";
-const char ver_string_3[] PROGMEM = "Flag via hardware monitoring";
-
-const char* const ver_string_array[] PROGMEM = {ver_string_0, ver_string_1, ver_string_2, ver_string_3};
-
-char const g_ver_buffer[32];
-
-char const * const getVersionString(int verNum)
+// The shell's input: a macro being played back, then the serial port
+uint8_t shellAvailable()
 {
-  verNum %= 4;
-  strcpy_P(g_ver_buffer, (char*) pgm_read_ptr(&ver_string_array[verNum]));
-  return g_ver_buffer;
+  return gVault.playLeft || Serial.available();
 }
 
-void commandGetVersion()
+int shellRead()
 {
-#ifdef DEBUG_MODE
-  Serial.print(F("DEBUG! "));
-#else
-  Serial.print(F("Version: "));
-#endif
-
-  Serial.println(gChallengeMode);
-  Serial.println(getVersionString(gChallengeMode));
+  if (gVault.playLeft)
+  {
+    gVault.playLeft--;
+    if (gVault.playLeft == 0)
+    {
+      // Ends the macro's last command
+      return '\n';
+    }
+    return macroByte(gVault.playAddr++);
+  }
+  return Serial.read();
+}
 
+// name has room for MACRO_NAME_LEN + 2, one more than a name can be, so
+// readString() running out of buffer shows up as too long
+uint8_t readMacroName(char* name)
+{
+  Serial.println(F("Macro name"));
+  int len = readString(MACRO_NAME_LEN + 2, name, 30);
+  Serial.println(F(""));
+  if (len <= 0)
+  {
+    Serial.println(F("No macro name"));
+    return 0;
+  }
+  if (len > MACRO_NAME_LEN)
+  {
+    Serial.println(F("Macro name too long"));
+    return 0;
+  }
+  return 1;
 }
 
-void commandNextChallenge()
+void commandMacro()
 {
-  if (gBgMode == 3)
+  if (gVault.playLeft)
   {
-    Serial.println(F("Can't be on flag screen!"));
+    // It could move the macro being played out from under us
+    Serial.println(F("Not from inside a macro"));
     return;
   }
 
-  Serial.println(F("You really want to goto next challenge?"));
-  Serial.println(F("Type yes to confirm"));
+  char name[MACRO_NAME_LEN + 2];
+  if (!readMacroName(name))
+  {
+    return;
+  }
 
-  char buf[4];
-  int num_chars = readString(4, buf, 30);
+  Serial.println(F("Commands, ; between them, empty to delete"));
+  char body[MACRO_BODY_LEN + 2];
+  int len = readStringTo(sizeof(body), body, 30, 0);
   Serial.println(F(""));
-
-  if (num_chars != 3)
+  if (len < 0)
+  {
     return;
-
-  if ( (buf[0] != 'y') || (buf[1] != 'e' ) || (buf[2] != 's') )
+  }
+  if (len > MACRO_BODY_LEN)
+  {
+    Serial.println(F("Macro too long"));
     return;
+  }
 
-  gChallengeMode += 1;
-  if (gChallengeMode == 4)
-    gChallengeMode = 0;
-
-  Serial.println(F("Mode changed to "));
-
-  Serial.println(gChallengeMode);
-  Serial.println(getVersionString(gChallengeMode));
+  uint16_t rec = macroFind(name);
+  if (macroExists(rec))
+  {
+    macroDelete(rec);
+  }
 
-  clockWrite(CHAL_MODE_ADDR, CHAL_MODE_LEN, &gChallengeMode);
-  gIsLocked = 1;
+  if (len == 0)
+  {
+    Serial.println(F("Macro deleted"));
+  }
+  else if (!macroAdd(name, body))
+  {
+    Serial.println(F("No room for the macro"));
+  }
+  else
+  {
+    Serial.println(F("Macro saved"));
+  }
 }
 
-void commandLock()
+void commandMacros()
 {
-  Serial.println(F("Locking!"));
-  gIsLocked = 1;
-}
+  uint16_t end = macroFind(NULL);
+  uint16_t rec = MACRO_LIST_ADDR;
+  while (rec < end)
+  {
+    uint8_t len = macroByte(rec);
+    uint16_t addr = rec + 1;
+    uint16_t nameEnd = addr + MACRO_NAME_LEN + 1;
+    uint8_t c;
 
-void commandUnlock()
-{
-  char pinCode[PIN_CODE_DIGITS + 1];
-  memset(pinCode, 0, PIN_CODE_DIGITS+1);
+    Serial.print(F(" "));
+    while ( (addr < nameEnd) && ((c = macroByte(addr++)) != 0) )
+    {
+      Serial.write(c);
+    }
+    Serial.print(F(": "));
+    while (addr < rec + 1 + len)
+    {
+      Serial.write(macroByte(addr++));
+    }
+    Serial.println(F(""));
 
-  Serial.println(F("Enter the pin (no mor than 5 digits)"));
+    rec += 1 + len;
+  }
 
-  int br = readString(PIN_CODE_DIGITS + 1, pinCode, 30);
-  if (br == -1)
+  Serial.print(end - MACRO_LIST_ADDR);
+  Serial.print(F(" of "));
+  Serial.print(MACRO_LIST_END - MACRO_LIST_ADDR);
+  Serial.println(F(" bytes used"));
+}
+
+void commandRun()
+{
+  if (gVault.playLeft)
   {
-    Serial.println(F("Timeout waiting for pin code"));
+    Serial.println(F("Not from inside a macro"));
     return;
   }
 
-  unsigned long pinRaw = strtoul(pinCode, 0, 10);
-
-  uint32_t expectedPin = readPinFromRam(gChallengeMode);
-  Serial.println(F(""));
-
-  if (pinRaw == expectedPin)
+  char name[MACRO_NAME_LEN + 2];
+  if (!readMacroName(name))
   {
-    Serial.println(F("PIN ACCEPTED!"));
-    gIsLocked = 0;
+    return;
   }
-  else
-  {
-    Serial.print(F("PIN "));
-    Serial.print(pinRaw);
-    Serial.println(F(" INVALID"));
 
-    if (gChallengeMode >= 2)
-    {
-      Serial.println(F("Brute force guard!  Wait 5 seconds"));
-      delay(5000);
-      Serial.println(F("You can try again now!"));
-    }
+  uint16_t rec = macroFind(name);
+  if (!macroExists(rec))
+  {
+    Serial.println(F("No such macro"));
+    return;
   }
 
+  // runShell() plays it out, over several loop passes if it takes longer
+  // than SHELL_DRAIN_MS
+  uint8_t nameLen = strlen(name);
+  gVault.playAddr = rec + 1 + nameLen + 1;
+  gVault.playLeft = macroByte(rec) - nameLen - 1 + 1;
 }
 
 void commandGetHighScore()
@@ -999,15 +2857,17 @@ void commandSetHighScore()
     return;
   }
 
-  uint16_t hsVal = strtoul(highscore, 0, 10);
+  uint16_t hsVal = parseDec(highscore);
   clockWrite(HIGH_SCORE_ADDR, HIGH_SCORE_LEN, (unsigned char*) &hsVal);
   Serial.print(F("Wrote high score of "));
   Serial.print(hsVal);
   Serial.println(F(" to backup RAM"));
 }
 
-void displayClock()
+void clockUpdate()
 {
+  memset(gVault.frameText, 0, sizeof(gVault.frameText));
+
   unsigned char curTime[3];
   if (clockRead(0, 3, curTime) != 3)
   {
@@ -1015,25 +2875,15 @@ void displayClock()
     return;
   }
 
-  char timeStr[12];
-  memset(timeStr, 0, 12);
-  timeStr[0] = '0' + ( (curTime[2] & 0x30) >> 4);
-  timeStr[1] = '0' + (curTime[2] & 0x0f);
+  char* timeStr = gVault.frameText;
+  fmtBcd(timeStr, curTime[2] & 0x3f);
   timeStr[2] = ':';
-  timeStr[3] = '0' + ( (curTime[1] & 0xf0) >> 4);
-  timeStr[4] = '0' + (curTime[1] & 0x0f);
+  fmtBcd(timeStr + 3, curTime[1]);
   timeStr[5] = ':';
-  timeStr[6] = '0' + ( (curTime[0] & 0x70) >> 4);
-  timeStr[7] = '0' + (curTime[0] & 0x0f);
+  fmtBcd(timeStr + 6, curTime[0] & 0x7f);
 
-  if ( (curTime[2] & 0x40) )
-  {
-    // Display 24 hr clock
-    display.clearDisplay();
-    writeString(timeStr, 14, 25);
-    display.display();
-  }
-  else
+  gVault.clock24Hr = curTime[2] & 0x40;
+  if (!gVault.clock24Hr)
   {
     if (curTime[2] & 0x20)
     {
@@ -1049,29 +2899,66 @@ void displayClock()
       timeStr[9] = 'A';
       timeStr[10] = 'M';
     }
+  }
+}
 
+void displayClock()
+{
+  if (gVault.clock24Hr)
+  {
+    // Display 24 hr clock
+    writeString(gVault.frameText, 14, 25);
+  }
+  else
+  {
     // Display 12 hr clock
-    display.clearDisplay();
-    writeString(timeStr, 14, 12);
-    writeString(&timeStr[9], 50, 38);
-    display.display();
+    writeString(gVault.frameText, 14, 12);
+    writeString(&gVault.frameText[9], 50, 38);
+  }
+}
+
+const char WAIT_MSG[] PROGMEM = "WRONG";
+
+// Challenge 3 makes a wrong pin wait this long before the next guess
+#define WRONG_PIN_WAIT_SECS 20
+
+void wrongCountdownTick()
+{
+  if (gVault.wrongCountdown == 0)
+  {
+    timerStop(&gVault.wrongTimer);
+    return;
   }
+
+  gVault.wrongCountdown--;
 }
 
-uint16_t gCurrentPinGuess = 0;
-uint8_t gCurrentPinGuessPos = 0;
+void drawWrongCountdown()
+{
+  char buf[8];
+  strcpy_P(buf, WAIT_MSG);
+  writeString(buf, 30 ,10);
+
+  fmtDec(buf, gVault.wrongCountdown);
+  writeString(buf, 60, 40);
+}
 
 void  displayUnlock()
 {
-  display.clearDisplay();
+  if (timerArmed(&gVault.wrongTimer))
+  {
+    drawWrongCountdown();
+    return;
+  }
+
   //writeString("Unlock Display", 0, 10);
   //display.display();
 
-  writeString("v", gCurrentPinGuessPos * 16, 0);
-  writeString("^", gCurrentPinGuessPos * 16, 40);
+  writeString("v", gVault.currentPinGuessPos * 16, 0);
+  writeString("^", gVault.currentPinGuessPos * 16, 40);
 
   uint8_t singleDigit;
-  uint16_t curModPin = gCurrentPinGuess;
+  uint16_t curModPin = gVault.currentPinGuess;
   char strBuf[2];
   strBuf[1] = 0;
   for(int i = 0; i < 5; i++)
@@ -1081,138 +2968,140 @@ void  displayUnlock()
     strBuf[0] = '0' + singleDigit;
     writeString(strBuf, 64 - i * 16, 20);
   }
-  display.display();
 
-  //gIsLocked = 0;
+  //gVault.isLocked = 0;
   //runShell(1000);
 }
 
 void unlockUpHandler()
 {
   uint16_t curPosVal = 1;
-  for(uint8_t i = 0; i < 4 - gCurrentPinGuessPos; i++)
+  for(uint8_t i = 0; i < 4 - gVault.currentPinGuessPos; i++)
   {
     curPosVal *= 10;
   }
 
-  gCurrentPinGuess += curPosVal;
+  gVault.currentPinGuess += curPosVal;
 
-  Serial.print(F("gCurrentPinGuess: "));
-  Serial.println(gCurrentPinGuess);
+  Serial.print(F("gVault.currentPinGuess: "));
+  Serial.println(gVault.currentPinGuess);
 }
 
 void unlockDownHandler()
 {
   uint16_t curPosVal = 1;
-  for(uint8_t i = 0; i < 4 - gCurrentPinGuessPos; i++)
+  for(uint8_t i = 0; i < 4 - gVault.currentPinGuessPos; i++)
   {
     curPosVal *= 10;
   }
 
-  gCurrentPinGuess -= curPosVal;
+  gVault.currentPinGuess -= curPosVal;
 
-  Serial.print(F("gCurrentPinGuess: "));
-  Serial.println(gCurrentPinGuess);
+  Serial.print(F("gVault.currentPinGuess: "));
+  Serial.println(gVault.currentPinGuess);
 }
 
 void unlockLeftHandler()
 {
-  if (gCurrentPinGuessPos == 0)
+  if (gVault.currentPinGuessPos == 0)
   {
     return;
   }
 
-  gCurrentPinGuessPos -= 1;
+  gVault.currentPinGuessPos -= 1;
 
-  Serial.print(F("gCurrentPinGuessPos: "));
-  Serial.println(gCurrentPinGuessPos);
+  Serial.print(F("gVault.currentPinGuessPos: "));
+  Serial.println(gVault.currentPinGuessPos);
 }
 
 void unlockRightHandler()
 {
-  if (gCurrentPinGuessPos >= 4)
+  if (gVault.currentPinGuessPos >= 4)
   {
     return;
   }
 
-  gCurrentPinGuessPos += 1;
+  gVault.currentPinGuessPos += 1;
 }
 
 void unlockAHandler()
 {
-  gFreshModeChange = 20;
+  showModeBanner();
 }
 
-const char WAIT_MSG[] PROGMEM = "WRONG";
-
 void unlockBHandler()
 {
-  uint32_t expectedPin = readPinFromRam(gChallengeMode);
+  if (timerArmed(&gVault.wrongTimer))
+  {
+    // Still waiting out the last wrong guess
+    return;
+  }
+
+  uint32_t expectedPin = readPinFromRam(gVault.challengeMode);
 
-  if (gCurrentPinGuess == expectedPin)
+  if (gVault.currentPinGuess == expectedPin)
   {
     Serial.println(F("Valid Pin"));
-    digitalWrite(GREEN_LED, 1);
-    digitalWrite(RED_LED, 0);
-    gLedTimer = 20;
-    gIsLocked = 0;
+    ledOneShot(GREEN_LED_CH, LED_PIN_RESULT_MS);
+    ledOff(RED_LED_CH);
+    gVault.isLocked = 0;
+    invalidateScreen(SCREEN_INPUT_LOCK);
   }
   else
   {
     Serial.println(F("Invalid pin"));
-    digitalWrite(GREEN_LED, 0);
-    digitalWrite(RED_LED, 1);
-    gLedTimer = 20;
+    ledOff(GREEN_LED_CH);
+    ledOneShot(RED_LED_CH, LED_PIN_RESULT_MS);
 
-    if (gChallengeMode == 3)
+    if (gVault.challengeMode == 3)
     {
-      char buf[8];
-      for(int i = 20; i >= 0; i--)
-      {
-        display.clearDisplay();
-        strcpy_P(buf, WAIT_MSG);
-        writeString(buf, 30 ,10);
-
-        sprintf(buf,"%d", i);
-        writeString(buf, 60, 40);
-
-        display.display();
-        delay(1000);
-      }
+      gVault.wrongCountdown = WRONG_PIN_WAIT_SECS;
+      timerEvery(&gVault.wrongTimer, 1000, wrongCountdownTick);
     }
   }
 }
 
 
-void displayVersion()
+// Pages the version and flag screens put their long lines at
+#define VERSION_LONG_PAGE 3
+#define FLAG_LONG_PAGE 3
+
+void versionUpdate()
 {
-  display.clearDisplay();
+  longLineSet(getVersionString(gVault.challengeMode), VERSION_LONG_PAGE);
+}
 
+void displayVersion()
+{
   char versionNum[10];
 
 #ifdef DEBUG_MODE
-  sprintf(versionNum, "DBG 1.%d", gChallengeMode);
+  fmtDec(fmtStr_P(versionNum, PSTR("DBG 1.")), gVault.challengeMode);
 #else
-  sprintf(versionNum, "Ver 1.%d", gChallengeMode);
+  fmtDec(fmtStr_P(versionNum, PSTR("Ver 1.")), gVault.challengeMode);
 #endif
 
-  writeString(versionNum, 0, 10);
+  writeString(versionNum, 0, 0);
 
-  writeString(getVersionString(gChallengeMode), 0, 25);
-  display.display();
+  drawLongLine();
 }
 
-void displayFlag()
+void flagUpdate()
 {
-  char flagStr[FLAG_LEN+0x10];
+  memset(gVault.frameText, 0, sizeof(gVault.frameText));
+
+  char* flagStr = gVault.frameText;
   strcpy(flagStr, "wildcat{");
   getFlagMyChalMode(flagStr + strlen(flagStr));
   flagStr[strlen(flagStr)] = '}';
   flagStr[strlen(flagStr)] = 0;
 
-  display.clearDisplay();
-  writeString(flagStr, 0, 0);
-  display.display();
+  longLineSet(gVault.frameText, FLAG_LONG_PAGE);
+}
+
+void displayFlag()
+{
+  drawLongLine();
 }
 
 const char SECURE_MSG[] PROGMEM = "Vault\nSecured";
@@ -1220,45 +3109,67 @@ const char SECURE_MSG[] PROGMEM = "Vault\nSecured";
 void displayLock()
 {
   char buf[14];
-  display.clearDisplay();
   strcpy_P(buf, SECURE_MSG);
   writeString(buf, 0 ,10);
-  display.display();
-  gIsLocked = 1;
+}
+
+void lockEnter()
+{
+  gVault.isLocked = 1;
+  invalidateScreen(SCREEN_INPUT_LOCK);
 }
 
 void displayChangeModes()
 {
-  display.clearDisplay();
-  displayMode(gBgMode, 10, 20);
-  display.display();
+  // Drawn as an overlay, so only clear the banner region
+  display.fillRect(BANNER_X, BANNER_Y, BANNER_W, BANNER_H, SSD1306_BLACK);
+  display.drawRect(BANNER_X, BANNER_Y, BANNER_W, BANNER_H, SSD1306_WHITE);
+  displayMode(gVault.bgMode, 10, 20);
 }
 
 /**
  * Reads a string from serial port.  Caller supplies buffer.  If successful,
  * a string returned without /n on end, null-terminated, and num chars read.
+ * A ; ends it too, so prompts can be answered on the command's own line.
  * @param timeoutVal How long to wait for user in seconds
  */
 int readString(int len, char* strBuf, unsigned long timeoutVal)
+{
+  return readStringTo(len, strBuf, timeoutVal, 1);
+}
+
+/**
+ * readString(), but ; only ends the string if stopAtSemi is set
+ */
+int readStringTo(int len, char* strBuf, unsigned long timeoutVal, uint8_t stopAtSemi)
 {
   memset(strBuf, 0, len);
   unsigned char pos = 0;
   timeoutVal = millis() * (timeoutVal * 1000);
   while(millis() < timeoutVal)
   {
-    if (Serial.available())
+    if (shellAvailable())
     {
-      strBuf[pos] = Serial.read();
+      strBuf[pos] = shellRead();
+      if (strBuf[pos] == SERIAL_LINE_LOST)
+      {
+        // Part of the line is missing, start again from nothing so the
+        // line end that follows gives back an empty string
+        memset(strBuf, 0, len);
+        pos = 0;
+        continue;
+      }
       Serial.print( (char) strBuf[pos] ); // echo
     }
     else
     {
       // Nothing available yet
+      wdt_reset();
       delay(10);
       continue;
     }
 
-    if ( (strBuf[pos] == '\n') || (strBuf[pos] == '\r') )
+    if ( (strBuf[pos] == '\n') || (strBuf[pos] == '\r') || (stopAtSemi && (strBuf[pos] == ';')) )
     {
       strBuf[pos] = 0;
       return pos;
@@ -1278,24 +3189,40 @@ int readString(int len, char* strBuf, unsigned long timeoutVal)
 
 void hexPrint(unsigned char val)
 {
-  unsigned char nibble = val / 16;
-  if (nibble >= 10)
-  {
-    Serial.write('a' + nibble - 10);
-  }
-  else
-  {
-    Serial.write('0' + nibble);
-  }
+  char buf[3];
+  fmtHex8(buf, val);
+  Serial.write(buf, 2);
+}
 
-  nibble = val % 16;
-  if (nibble >= 10)
-  {
-    Serial.write('a' + nibble - 10);
-  }
-  else
+void i2cPrintError(uint8_t err)
+{
+  switch(err)
   {
-    Serial.write('0' + nibble);
+    case I2C_OK:
+      Serial.println(F("Success"));
+      break;
+    case I2C_TOO_LONG:
+      Serial.println(F("Data too long!"));
+      break;
+    case I2C_NAK_ADDR:
+      Serial.println(F("Received NAK on address"));
+      break;
+    case I2C_NAK_DATA:
+      Serial.println(F("Received NAK on data"));
+      break;
+    case I2C_OTHER:
+      Serial.println(F("Other error"));
+      break;
+    case I2C_TIMEOUT:
+      Serial.println(F("Timeout"));
+      break;
+    case I2C_SHORT_READ:
+      Serial.println(F("Short read"));
+      break;
+    default:
+      Serial.println(F("Invalid error code"));
+      Serial.print(F("Err code ="));
+      Serial.println(err);
   }
 }
 
@@ -1303,111 +3230,122 @@ int clockWrite(unsigned char clockAddr,
                 unsigned char numBytes,
                 unsigned char* buf)
 {
-  Serial.println(F("clockWrite"));
-
-  Wire.beginTransmission(RTC_I2C_ADDR);
-  Wire.write(clockAddr);
+  int retVal = i2cWrite(RTC_I2C_ADDR, clockAddr, buf, numBytes);
 
-  int br = Wire.write(buf, numBytes);
-  if (br != numBytes)
+  trace(TRACE_CLOCK_WRITE, clockAddr, numBytes);
+  if (retVal)
   {
-    Serial.print(F("Wire.write wrote "));
-    Serial.print(br);
-    Serial.print(F(" bytes of expected "));
-    Serial.println(numBytes);
+    flight(TRACE_I2C_ERROR, RTC_I2C_ADDR, retVal);
+    i2cPrintError(retVal);
   }
-  
-  int retVal = Wire.endTransmission();
-
-  Serial.print(F("Wrote "));
-  Serial.print(numBytes);
-  Serial.print(F(" bytes to "));
-  hexPrint(clockAddr);
-  Serial.println(F(""));
 
   return retVal;
 }
 
+// Bytes per line of the challenge 1 bus dump, a whole flag fits in one:
+// "Read 255: " and 24 hex digits is 36 characters with the line end
+#define CLOCK_DUMP_LINE FLAG_LEN
+
+// Returns the number of bytes read, which is numBytes or 0: I2cBus has
+// already retried anything short
 unsigned char clockRead(unsigned char clockAddr,
                         unsigned char numBytes,
                         unsigned char* buf)
 {
   //Serial.println(F("clockRead"));
 
-  Wire.beginTransmission(RTC_I2C_ADDR);
-  Wire.write(clockAddr);
-  int err = Wire.endTransmission();
+  uint8_t err = i2cRead(RTC_I2C_ADDR, clockAddr, buf, numBytes);
+  uint8_t br = err ? 0 : numBytes;
 
   if (err)
   {
-    switch(err)
-    {
-      case 0:
-        Serial.println(F("Success"));
-        break;
-      case 1:
-        Serial.println(F("Data too long!"));
-        break;
-      case 2:
-        Serial.println(F("Received NAK on address"));
-        break;
-      case 3:
-        Serial.println(F("Received NAK on data"));
-        break;
-      case 4:
-        Serial.println(F("Other error"));
-        break;
-      case 5:
-        Serial.println(F("Timeout"));
-        break;
-      default:
-        Serial.println(F("Invalid error code"));
-        Serial.print(F("Err code ="));
-        Serial.println(err);
-    }
+    flight(TRACE_I2C_ERROR, RTC_I2C_ADDR, err);
+    i2cPrintError(err);
   }
 
-  int br = Wire.requestFrom( (uint8_t) 0x68, (uint8_t) numBytes);
-
-  if (gChallengeMode == 0)
+  if (gVault.challengeMode == 0)
   {
-    // Print out all the I2C traffic for challenge 1 onlyg
-    Serial.print(F("Read "));
-    Serial.print( (int) clockAddr );
-    Serial.print(F(": "));
-    for(int i = 0; i < br; i++)
+    // Print out all the I2C traffic for challenge 1 onlyg.  Best effort,
+    // in lines short enough that Diag sends each one whole or not at all
+    for(int i = 0; i < br; i += CLOCK_DUMP_LINE)
     {
-      if (Wire.available() == 0)
+      Diag.print(F("Read "));
+      Diag.print( (int) clockAddr + i );
+      Diag.print(F(": "));
+      for(int j = i; (j < br) && (j < i + CLOCK_DUMP_LINE); j++)
       {
-        Serial.print(F("Error. read "));
-        Serial.print(br);
-        Serial.print(F(" bytes, but only "));
-        Serial.print(i);
-        Serial.println(F(" available"));
-        return i;
+        char hex[3];
+        fmtHex8(hex, buf[j]);
+        Diag.write(hex, 2);
       }
-
-      buf[i] = Wire.read();
-      hexPrint(buf[i]);
+      Diag.println(F(""));
     }
-    Serial.println(F(""));
-  }
-  else
-  {
-      for(int i = 0; i < br; i++)
-      {
-        if (Wire.available() == 0)
-        {
-          return i;
-        }
-
-        buf[i] = Wire.read();
-      }
   }
 
   return br;
 }
 
+void commandI2cStats()
+{
+  const struct I2cStats* st = i2cGetStats();
+
+  Serial.print(F("Transfers: "));
+  Serial.println(st->transfers);
+  Serial.print(F("Last us: "));
+  Serial.println(st->lastUs);
+  Serial.print(F("Max us: "));
+  Serial.println(st->maxUs);
+  Serial.print(F("Retries: "));
+  Serial.println(st->retries);
+  Serial.print(F("Failures: "));
+  Serial.println(st->failures);
+  Serial.print(F("Recoveries: "));
+  Serial.println(st->recoveries);
+  Serial.print(F("Last error: "));
+  i2cPrintError(st->lastError);
+}
+
+void commandSerialStats()
+{
+  struct SerialRxStats st;
+  serialGetStats(&st);
+
+  Serial.print(F("RX ring: "));
+  Serial.println(SERIAL_RX_RING_LEN);
+  Serial.print(F("RX peak: "));
+  Serial.println(st.peak);
+  Serial.print(F("RX bytes: "));
+  Serial.println(st.bytes);
+  Serial.print(F("RX dropped: "));
+  Serial.println(st.dropped);
+  Serial.print(F("Lines lost: "));
+  Serial.println(st.linesLost);
+  Serial.print(F("Overruns: "));
+  Serial.println(st.overruns);
+  Serial.print(F("Frame errors: "));
+  Serial.println(st.frameErrors);
+
+  struct SerialTxStats tx;
+  serialGetTxStats(&tx);
+
+  Serial.print(F("TX bytes: "));
+  Serial.println(tx.bytes);
+  Serial.print(F("TX stalls: "));
+  Serial.println(tx.stalls);
+
+  struct SerialDiagStats diag;
+  Diag.getStats(&diag);
+
+  Serial.print(F("Diag lines: "));
+  Serial.println(diag.lines);
+  Serial.print(F("Diag dropped: "));
+  Serial.println(diag.linesDropped);
+  Serial.print(F("Diag cut: "));
+  Serial.println(diag.linesCut);
+  Serial.print(F("Diag bytes lost: "));
+  Serial.println(diag.bytesDropped);
+}
+
 void loop()
 {
   // Never called
@@ -1427,197 +3365,191 @@ void writeString(char* msg, int x, int y)
 
 void defaultUpHandler()
 {
-  Serial.println(F("Up"));
+  Diag.println(F("Up"));
   modeUp();
 }
 
 void defaultDownHandler()
 {
-  Serial.println(F("Down"));
+  Diag.println(F("Down"));
   modeDown();
 }
 
 void defaultLeftHandler()
 {
-  Serial.println(F("Left"));
+  Diag.println(F("Left"));
 }
 
 void defaultRightHandler()
 {
-  Serial.println(F("Right"));
+  Diag.println(F("Right"));
 }
 
 void defaultAButtonHandler()
 {
-  Serial.println(F("A Button"));
+  Diag.println(F("A Button"));
 }
 
 void defaultBButtonHandler()
 {
-  Serial.println(F("B Button"));
+  Diag.println(F("B Button"));
 }
 
 
 void readDigitalButtons()
 {
-  if (gLedTimer)
+  uint8_t pressed = ~ButtonPins::read();
+
+  uint8_t newPresses = pressed & ~gVault.oldButtonStates &
+                       (OLD_BUTTON_STATE_UP | OLD_BUTTON_STATE_DOWN | OLD_BUTTON_STATE_LEFT |
+                        OLD_BUTTON_STATE_RIGHT | OLD_BUTTON_STATE_A | OLD_BUTTON_STATE_B);
+  if (newPresses)
   {
-    gLedTimer--;
-    if (gLedTimer == 0)
+    uint8_t wasOff = (gVault.displayIdle == DISPLAY_OFF);
+    displayActivity();
+    if (wasOff)
     {
-      digitalWrite(RED_LED, 0);
-      digitalWrite(GREEN_LED, 0);
+      // A press on a blank screen only wakes it, nobody could see what it
+      // would have done.  Treat the buttons as already held.
+      gVault.oldButtonStates |= newPresses;
+      return;
     }
   }
 
-  if (digitalRead(UP_BUTTON) == 0)
+  if (pressed & OLD_BUTTON_STATE_UP)
   {
-    if (!(gOldButtonStates & OLD_BUTTON_STATE_UP))
+    if (!(gVault.oldButtonStates & OLD_BUTTON_STATE_UP))
     {
-      if (gFreshModeChange)
+      if (modeBannerUp())
       {
         defaultUpHandler();
       }
       else
       {
-        gButtonHandlersForMode[gBgMode]->upFunc();
+        gButtonHandlersForMode[gVault.bgMode]->upFunc();
       }
 
-      gOldButtonStates |= OLD_BUTTON_STATE_UP;
+      gVault.oldButtonStates |= OLD_BUTTON_STATE_UP;
     }
   }
   else
   {
-    gOldButtonStates &= ~OLD_BUTTON_STATE_UP;
+    gVault.oldButtonStates &= ~OLD_BUTTON_STATE_UP;
   }
 
-  if (digitalRead(DOWN_BUTTON) == 0)
+  if (pressed & OLD_BUTTON_STATE_DOWN)
   {
-    if (!(gOldButtonStates & OLD_BUTTON_STATE_DOWN))
+    if (!(gVault.oldButtonStates & OLD_BUTTON_STATE_DOWN))
     {
-      if (gFreshModeChange)
+      if (modeBannerUp())
       {
         defaultDownHandler();
       }
       else
       {
-        gButtonHandlersForMode[gBgMode]->downFunc();
+        gButtonHandlersForMode[gVault.bgMode]->downFunc();
       }
-      gOldButtonStates |= OLD_BUTTON_STATE_DOWN;
+      gVault.oldButtonStates |= OLD_BUTTON_STATE_DOWN;
     }
   }
   else
   {
-    gOldButtonStates &= ~ OLD_BUTTON_STATE_DOWN;
+    gVault.oldButtonStates &= ~ OLD_BUTTON_STATE_DOWN;
   }
 
-  if (digitalRead(LEFT_BUTTON) == 0)
+  if (pressed & OLD_BUTTON_STATE_LEFT)
   {
-    if (!(gOldButtonStates & OLD_BUTTON_STATE_LEFT))
+    if (!(gVault.oldButtonStates & OLD_BUTTON_STATE_LEFT))
     {
-      if (gFreshModeChange)
+      if (modeBannerUp())
       {
         defaultLeftHandler();
       }
       else
       {
-        gButtonHandlersForMode[gBgMode]->leftFunc();
+        gButtonHandlersForMode[gVault.bgMode]->leftFunc();
       }
-      gOldButtonStates |= OLD_BUTTON_STATE_LEFT;
+      gVault.oldButtonStates |= OLD_BUTTON_STATE_LEFT;
     }
   }
   else
   {
-    gOldButtonStates &= ~OLD_BUTTON_STATE_LEFT;
+    gVault.oldButtonStates &= ~OLD_BUTTON_STATE_LEFT;
   }
 
-  if (digitalRead(RIGHT_BUTTON) == 0)
+  if (pressed & OLD_BUTTON_STATE_RIGHT)
   {
-    if (!(gOldButtonStates & OLD_BUTTON_STATE_RIGHT))
+    if (!(gVault.oldButtonStates & OLD_BUTTON_STATE_RIGHT))
     {
-      if (gFreshModeChange)
+      if (modeBannerUp())
       {
         defaultRightHandler();
       }
       else
       {
-        gButtonHandlersForMode[gBgMode]->rightFunc();
+        gButtonHandlersForMode[gVault.bgMode]->rightFunc();
       }
-      gOldButtonStates |= OLD_BUTTON_STATE_RIGHT;
+      gVault.oldButtonStates |= OLD_BUTTON_STATE_RIGHT;
     }
   }
   else
   {
-    gOldButtonStates &= ~OLD_BUTTON_STATE_RIGHT;
+    gVault.oldButtonStates &= ~OLD_BUTTON_STATE_RIGHT;
   }
 
 
-  if (digitalRead(A_BUTTON) == 0)
+  if (pressed & OLD_BUTTON_STATE_A)
   {
-    if (!(gOldButtonStates & OLD_BUTTON_STATE_A))
+    if (!(gVault.oldButtonStates & OLD_BUTTON_STATE_A))
     {
-      if (gFreshModeChange)
+      if (modeBannerUp())
       {
         defaultAButtonHandler();
       }
       else
       {
-        gButtonHandlersForMode[gBgMode]->aButtonFunc();
+        gButtonHandlersForMode[gVault.bgMode]->aButtonFunc();
       }
-      gOldButtonStates |= OLD_BUTTON_STATE_A;
+      gVault.oldButtonStates |= OLD_BUTTON_STATE_A;
     }
   }
   else
   {
-    gOldButtonStates &= ~OLD_BUTTON_STATE_A;
+    gVault.oldButtonStates &= ~OLD_BUTTON_STATE_A;
   }
 
 
-  if (digitalRead(B_BUTTON) == 0)
+  if (pressed & OLD_BUTTON_STATE_B)
   {
-    if (!(gOldButtonStates & OLD_BUTTON_STATE_B))
+    if (!(gVault.oldButtonStates & OLD_BUTTON_STATE_B))
     {
-      if (gFreshModeChange)
+      if (modeBannerUp())
       {
         defaultBButtonHandler();
       }
       else
       {
-        gButtonHandlersForMode[gBgMode]->bButtonFunc();
+        gButtonHandlersForMode[gVault.bgMode]->bButtonFunc();
       }
-      gOldButtonStates |= OLD_BUTTON_STATE_B;
+      gVault.oldButtonStates |= OLD_BUTTON_STATE_B;
     }
   }
   else
   {
-    gOldButtonStates &= ~OLD_BUTTON_STATE_B;
+    gVault.oldButtonStates &= ~OLD_BUTTON_STATE_B;
   }
 
 
 }
-struct Point
-{
-  int8_t x;
-  int8_t y;
-};
-
 bool operator==(struct Point const & lhs, struct Point const & rhs)
 {
   return (lhs.x == rhs.x) && (lhs.y == rhs.y);
 }
 
-#define MAX_APPLES 8
-#define MAX_SNAKE_LEN 16
-
-uint8_t gSnakeDir = 0;
-uint8_t gSnakeTime = 0;
-uint8_t gSnakeBufferPos = 0;
-uint8_t gSnakeLen = 0;
-uint8_t gSnakeSpeed = 0x5;
-uint16_t gSnakeScore = 0;
-
-Point gSnake[MAX_SNAKE_LEN];
-Point gApples[MAX_APPLES];
+#define SNAKE_APPLE_MS 3000
+#define SNAKE_MOVE_MS 200
+#define SNAKE_MOVE_MS_FAST 150
+#define SNAKE_MOVE_MS_FASTEST 100
 
 #define SNAKE_LEN_MAX 16
 #define SNAKE_LEN_MIN 3
@@ -1636,19 +3568,14 @@ void snakeDrawPixel(struct Point const & p)
   display.drawRect(p.x * 2, p.y * 2, 2, 2, 1);
 }
 
-void snakeClearPixel(struct Point const & p)
-{
-  display.drawRect(p.x * 2, p.y * 2, 2, 2, 0);
-}
-
 void snakeDrawApples()
 {
   for(int i = 0; i < MAX_APPLES; i++)
   {
     // Draw apples
-    if (gApples[i].x != -1)
+    if (gVault.apples[i].x != -1)
     {
-      snakeDrawPixel(gApples[i]);
+      snakeDrawPixel(gVault.apples[i]);
     }
   }
 
@@ -1658,14 +3585,14 @@ void snakeDrawSnake()
 {
   // Did the snake hit the snake?
   //Serial.print(F("SnakeLen= "));
-  //Serial.print(gSnakeLen);
+  //Serial.print(gVault.snakeLen);
   //Serial.print(F(", bufPos="));
-  //Serial.println(gSnakeBufferPos);
+  //Serial.println(gVault.snakeBufferPos);
 
-  int snakeIndex = gSnakeBufferPos;
+  int snakeIndex = gVault.snakeBufferPos;
 
   // skip index 0, cause we can't hit the current head
-  for(int i = 0; i < gSnakeLen; i++)
+  for(int i = 0; i < gVault.snakeLen; i++)
   {
     if (snakeIndex == -1)
     {
@@ -1674,11 +3601,11 @@ void snakeDrawSnake()
       snakeIndex = MAX_SNAKE_LEN - 1;
     }
 
-    snakeDrawPixel(gSnake[snakeIndex]);
+    snakeDrawPixel(gVault.snake[snakeIndex]);
     //Serial.print(F("S "));
-    //Serial.print(gSnake[snakeIndex].x);
+    //Serial.print(gVault.snake[snakeIndex].x);
     //Serial.print(F(","));
-    //Serial.println(gSnake[snakeIndex].y);
+    //Serial.println(gVault.snake[snakeIndex].y);
   
     snakeIndex--;
   }
@@ -1686,7 +3613,6 @@ void snakeDrawSnake()
 
 void snakeRedrawDisplay()
 {
-  display.clearDisplay();
   display.drawFastHLine(0, 0, SCREEN_WIDTH, 1);
   display.drawFastHLine(0, 1, SCREEN_WIDTH, 1);
   display.drawFastHLine(0, SCREEN_HEIGHT - 1, SCREEN_WIDTH, 1);
@@ -1699,53 +3625,59 @@ void snakeRedrawDisplay()
 
   snakeDrawApples();
   snakeDrawSnake();
-  display.display();
 }
 
 const char GAME_OVER_MSG[] PROGMEM  = "Game Over";
 const char HIGH_SCORE_MSG[] PROGMEM = "HighScore";
-void snakeReset(uint8_t draw_apples)
-{
-  // Snake game reset score / died
 
+void drawSnakeGameOver()
+{
   char buf[10];
 
-
-  for(int i = 0; i < 5; i++)
+  if (gVault.snakeShowApples)
   {
+    snakeDrawApples();
+  }
 
-    display.clearDisplay();
-
-    if ( (i < 3) && (draw_apples) )
-    {
-      snakeDrawApples();
-    }
+  strcpy_P(buf, GAME_OVER_MSG);
+  writeString(buf, 5, 5);
 
-    strcpy_P(buf, GAME_OVER_MSG);
-    writeString(buf, 5, 5);
+  fmtDec(buf, gVault.snakeScore);
+  writeString(buf, 5, 20);
 
-    sprintf(buf, "%d", gSnakeScore);
-    writeString(buf, 5, 20);
+  strcpy_P(buf, HIGH_SCORE_MSG);
+  writeString(buf, 5, 35);
 
-    uint16_t hs;
-    clockRead(HIGH_SCORE_ADDR, HIGH_SCORE_LEN, (unsigned char*) &hs);
-    if (gSnakeScore > hs)
-    {
-      Serial.println(F("New High Score"));
-      Serial.println(F("wildcat{**************}"));
-      hs = gSnakeScore;
-      clockWrite(HIGH_SCORE_ADDR, HIGH_SCORE_LEN, (unsigned char*) &hs);
-    }
+  fmtDec(buf, gVault.snakeHighScore);
+  writeString(buf, 5, 50);
+}
 
-    strcpy_P(buf, HIGH_SCORE_MSG);
-    writeString(buf, 5, 35);
+void snakeReset(uint8_t draw_apples)
+{
+  // Snake game reset score / died
+  gVault.snakeGames++;
+  if (gVault.snakeScore > gVault.snakeBestScore)
+  {
+    gVault.snakeBestScore = gVault.snakeScore;
+  }
 
-    sprintf(buf, "%d", hs);
-    writeString(buf, 5, 50);
+  uint16_t hs;
+  clockRead(HIGH_SCORE_ADDR, HIGH_SCORE_LEN, (unsigned char*) &hs);
+  if ( (gVault.snakeScore > hs) && !gVault.snakeAutoPlayed )
+  {
+    Serial.println(F("New High Score"));
+    Serial.println(F("wildcat{**************}"));
+    hs = gVault.snakeScore;
+    clockWrite(HIGH_SCORE_ADDR, HIGH_SCORE_LEN, (unsigned char*) &hs);
+  }
+  gVault.snakeHighScore = hs;
 
-    display.display();
+  for(int i = 0; i < 5; i++)
+  {
+    gVault.snakeShowApples = (i < 3) && (draw_apples);
+    displayRender(drawSnakeGameOver);
 
-    delay(1000);
+    watchdogDelay(1000);
   }
 
   snakeInit();
@@ -1753,247 +3685,473 @@ void snakeReset(uint8_t draw_apples)
 
 void snakeInit()
 {
-  Serial.println(F("SnakeInit"));
+  trace(TRACE_SNAKE_INIT, 0, 0);
   for(int i = 0; i < 8; i++)
   {
-    gApples[i].x = -1;
-    gApples[i].y = -1;
+    gVault.apples[i].x = -1;
+    gVault.apples[i].y = -1;
   }
 
-  gSnake[0].x = SNAKE_SCREEN_WIDTH >> 1;
-  gSnake[0].y = SNAKE_SCREEN_HEIGHT >> 1;
+  gVault.snake[0].x = SNAKE_SCREEN_WIDTH >> 1;
+  gVault.snake[0].y = SNAKE_SCREEN_HEIGHT >> 1;
 
-  gSnake[1].x = (SNAKE_SCREEN_WIDTH >> 1) + 1;
-  gSnake[1].y = SNAKE_SCREEN_HEIGHT >> 1;
+  gVault.snake[1].x = (SNAKE_SCREEN_WIDTH >> 1) + 1;
+  gVault.snake[1].y = SNAKE_SCREEN_HEIGHT >> 1;
   
-  gSnake[2].x = (SNAKE_SCREEN_WIDTH >> 1) + 2;
-  gSnake[2].y = SNAKE_SCREEN_HEIGHT >> 1;
-
-  //gSnakeBufferPos = 0x32;
-  gSnakeLen = 3;
-  gSnakeBufferPos = 2;
-  gSnakeDir = SNAKE_RIGHT;
-  gSnakeTime = 0;
-  gSnakeScore = 0;
-  gSnakeSpeed = 0x5;
-
+  gVault.snake[2].x = (SNAKE_SCREEN_WIDTH >> 1) + 2;
+  gVault.snake[2].y = SNAKE_SCREEN_HEIGHT >> 1;
+
+  //gVault.snakeBufferPos = 0x32;
+  gVault.snakeLen = 3;
+  gVault.snakeBufferPos = 2;
+  gVault.snakeDir = SNAKE_RIGHT;
+  gVault.snakeScore = 0;
+  gVault.snakeAutoPlayed = 0;
+  gVault.snakeMoveMs = SNAKE_MOVE_MS;
+  gVault.snakeReady = 1;
+
+  if (timerArmed(&gVault.snakeMoveTimer))
+  {
+    // Restarted mid game, put the move interval back to its starting value
+    snakeStartTimers();
+  }
 }
 
 void snakeUpHandler()
 {
-  Serial.println(F("S Up"));
-  gSnakeDir = SNAKE_UP;
+  Diag.println(F("S Up"));
+  gVault.snakeDir = SNAKE_UP;
 }
 
 void snakeDownHandler()
 {
-  Serial.println(F("S Down"));
-  gSnakeDir = SNAKE_DOWN;
+  Diag.println(F("S Down"));
+  gVault.snakeDir = SNAKE_DOWN;
 }
 
 void snakeLeftHandler()
 {
-  Serial.println(F("S Left"));
-  gSnakeDir = SNAKE_LEFT;
+  Diag.println(F("S Left"));
+  gVault.snakeDir = SNAKE_LEFT;
 }
 
 void snakeRightHandler()
 {
-  Serial.println(F("S Right"));
-  gSnakeDir = SNAKE_RIGHT;
+  Diag.println(F("S Right"));
+  gVault.snakeDir = SNAKE_RIGHT;
 }
 
 void snakeAButtonHandler()
 {
-  Serial.println(F("SA"));
-  gFreshModeChange = 20;
+  Diag.println(F("SA"));
+  if (gVault.oldButtonStates & OLD_BUTTON_STATE_B)
+  {
+    // Hold B (which restarts the game) and press A
+    snakeAutoToggle();
+    return;
+  }
+  showModeBanner();
 }
 
 void snakeBButtonHandler()
 {
-  Serial.println(F("SB"));
+  Diag.println(F("SB"));
   snakeInit();
 }
 
-void snakeBgMode()
+void snakeStartTimers()
 {
-  //uint8_t curTime = (gSnakeDir >> 2) & 0x3F;
-  uint8_t curTime = ++gSnakeTime;
-  //Serial.println(curTime);
-  
-  // At some large time interval, add an apple on the map
-  if ( (curTime & 0x3f) == 0x3f)
+  timerEvery(&gVault.snakeAppleTimer, SNAKE_APPLE_MS, snakeAppleTick);
+  timerEvery(&gVault.snakeMoveTimer, gVault.snakeMoveMs, snakeMoveTick);
+}
+
+void snakeSetSpeed(uint16_t moveMs)
+{
+  if (moveMs != gVault.snakeMoveMs)
+  {
+    gVault.snakeMoveMs = moveMs;
+    timerEvery(&gVault.snakeMoveTimer, gVault.snakeMoveMs, snakeMoveTick);
+  }
+}
+
+void snakeEnter()
+{
+  if (!gVault.snakeReady)
   {
-    Serial.println(F("Add an apple"));
-    // Add another apple
+    // Fast boot skips this until snake mode is first entered
+    snakeInit();
+  }
+
+  snakeStartTimers();
+}
+
+void snakeExit()
+{
+  // The game is paused while something else is on screen
+  timerStop(&gVault.snakeAppleTimer);
+  timerStop(&gVault.snakeMoveTimer);
+}
+
+// Every so often, add an apple on the map
+void snakeAppleTick()
+{
+  invalidateScreen(SCREEN_INPUT_GAME);
+
+  // Add another apple
 
-    digitalWrite(GREEN_LED, 1);
-    gLedTimer = 2;
+  ledOneShot(GREEN_LED_CH, LED_APPLE_MS);
 
-    uint8_t too_many_apples = 1;
-    for(int i = 0; i < 8; i++)
+  uint8_t too_many_apples = 1;
+  for(int i = 0; i < 8; i++)
+  {
+    if (gVault.apples[i].x == -1)
     {
-      if (gApples[i].x == -1)
-      {
-        gApples[i].x = random(SNAKE_SCREEN_WIDTH);
-        gApples[i].y = random(SNAKE_SCREEN_HEIGHT);
+      gVault.apples[i].x = random(SNAKE_SCREEN_WIDTH);
+      gVault.apples[i].y = random(SNAKE_SCREEN_HEIGHT);
 
-        Serial.print(F("Added an apple "));
-        Serial.print(gApples[i].x);
-        Serial.print(F(" x "));
-        Serial.print(gApples[i].y);
-        Serial.print(F(" , i ="));
-        Serial.println(i);
+      trace(TRACE_SNAKE_APPLE, gVault.apples[i].x, gVault.apples[i].y);
 
-        too_many_apples = 0;
-        i = 8;
+      too_many_apples = 0;
+      i = 8;
 
-        // This could add an apple where there is already an apple, but I snake code will probably only just eat one and then have to come back and eat it again
+      // This could add an apple where there is already an apple, but I snake code will probably only just eat one and then have to come back and eat it again
 
-        delay(100);
-      }
+      delay(100);
     }
+  }
 
-    if (too_many_apples)
-    {
-      Serial.println(F("Too many apples!"));
-      digitalWrite(RED_LED, 1);
-      snakeReset(1);
-      return;
-    }
-   
-  } // adding apples done
+  if (too_many_apples)
+  {
+    trace(TRACE_SNAKE_NO_APPLES, 0, 0);
+    ledOneShot(RED_LED_CH, LED_GAME_OVER_MS);
+    snakeReset(1);
+    return;
+  }
+}
+
+// Snake tick timing.  A host build's micros() is the board's virtual
+// clock, which CPU work doesn't move, so there the host's own clock times
+// the tick instead.
+#ifdef VAULT_HOST
+#define snakeTickMicros() hostMicros()
+#else
+#define snakeTickMicros() micros()
+#endif
+
+// At a shorter interval, move the snake
+void snakeMoveTick()
+{
+  unsigned long tickStart = snakeTickMicros();
+  invalidateScreen(SCREEN_INPUT_GAME);
+
+  if (gVault.snakeAuto)
+  {
+    snakeAutoSteer();
+  }
+
+  trace(TRACE_SNAKE_MOVE, gVault.snakeDir, gVault.snakeLen);
+
+  Point* curPos = gVault.snake + gVault.snakeBufferPos;
 
-  // At a shorter time interval, lets move the snake
-  if ( (curTime & gSnakeSpeed) == 0x0 )
+  int nextBufferPos = gVault.snakeBufferPos + 1;
+  if (nextBufferPos == MAX_SNAKE_LEN)
   {
-    // Discard the lowest 3 bits of the timer
-    Serial.println(F("Move the snake"));
+    nextBufferPos = 0;
+  }
+  Point* nextPos = gVault.snake + nextBufferPos;
+
+  nextPos->x = curPos->x;
+  nextPos->y = curPos->y;
+
+  switch (gVault.snakeDir) // & SNAKE_DIR_MASK)
+  {
+    case SNAKE_UP:
+      nextPos->y -= 1;
+      if (nextPos->y < 0)
+      {
+        trace(TRACE_SNAKE_WALL, gVault.snakeDir, 0);
+        snakeReset(0);
+        return;
+      }
+      break;
+    case SNAKE_DOWN:
+      nextPos->y += 1;
+      if (nextPos->y >= SNAKE_SCREEN_HEIGHT)
+      {
+        trace(TRACE_SNAKE_WALL, gVault.snakeDir, 0);
+        snakeReset(0);
+        return;
+      }
+      break;
+    case SNAKE_LEFT:
+      nextPos->x -= 1;
+      if (nextPos->x <= 0)
+      {
+        trace(TRACE_SNAKE_WALL, gVault.snakeDir, 0);
+        snakeReset(0);
+        return;
+      }
+      break;
+    case SNAKE_RIGHT:
+      nextPos->x += 1;
+      if (nextPos->x >= SNAKE_SCREEN_WIDTH - 1)
+      {
+        trace(TRACE_SNAKE_WALL, gVault.snakeDir, 0);
+        snakeReset(0);
+        return;
+      }
+      break;
+    default:
+      Serial.print(F(" [ERROR] "));
+      return;
+  } // end switch
 
-    Point* curPos = gSnake + gSnakeBufferPos;
+  // Did the snake hit the snake?
+  //uint8_t snakeLen = (gVault.snakeBufferPos >> 4) & 0xf + 1;
+  int snakeIndexToCheck = gVault.snakeBufferPos - 1;
+  // skip index 0, cause we can't hit the current head
+  for(int i = 1; i < gVault.snakeLen; i++)
+  {
+    if (snakeIndexToCheck == -1)
+    {
+      // wrap around
+      snakeIndexToCheck = MAX_SNAKE_LEN - 1;
+    }
 
-    int nextBufferPos = gSnakeBufferPos + 1;
-    if (nextBufferPos == MAX_SNAKE_LEN)
+    if (*nextPos == gVault.snake[snakeIndexToCheck])
     {
-      nextBufferPos = 0;
+      trace(TRACE_SNAKE_HIT, 0, 0);
+      snakeReset(0);
+      return;
     }
-    Point* nextPos = gSnake + nextBufferPos;
 
-    nextPos->x = curPos->x;
-    nextPos->y = curPos->y;
+      snakeIndexToCheck--;
+  }
+
+  // If we got here, we didn't hit anything
+  gVault.snakeBufferPos = nextBufferPos;
 
-    switch (gSnakeDir) // & SNAKE_DIR_MASK)
+  // Did the snake eat an apple?
+  for(int i = 0; i < 8; i++)
+  {
+    if (gVault.apples[i].x != -1)
     {
-      case SNAKE_UP:
-      Serial.print(F(" [UP] "));
-        nextPos->y -= 1;
-        if (nextPos->y < 0)
-        {
-          snakeReset(0);
-          Serial.println(F("Top hit!"));
-          return;
-        }
-        break;
-      case SNAKE_DOWN:
-      Serial.print(F(" [DOWN] "));
-        nextPos->y += 1;
-        if (nextPos->y >= SNAKE_SCREEN_HEIGHT)
+      if (*nextPos == gVault.apples[i])
+      {
+        gVault.apples[i].x = -1;
+        gVault.snakeLen += 1;
+        if (gVault.snakeLen == SNAKE_LEN_MAX)
         {
-          Serial.println(F("Bottom hit!"));
-          snakeReset(0);
-          return;
+          trace(TRACE_SNAKE_MAX_LEN, 0, 0);
+          gVault.snakeLen -= 1;
         }
-        break;
-      case SNAKE_LEFT:
-        Serial.print(F(" [LEFT] "));
-        nextPos->x -= 1;
-        if (nextPos->x <= 0)
+
+        gVault.snakeScore += 1;
+        trace(TRACE_SNAKE_EAT, gVault.snakeScore, gVault.snakeLen);
+        if (gVault.snakeScore > 25)
         {
-          Serial.println(F("Left wall hit!"));
-          snakeReset(0);
-          return;
+          snakeSetSpeed(SNAKE_MOVE_MS_FASTEST);
         }
-        break;
-      case SNAKE_RIGHT:
-      Serial.print(F(" [RIGHT] "));
-        nextPos->x += 1;
-        if (nextPos->x >= SNAKE_SCREEN_WIDTH - 1)
+        else if (gVault.snakeScore > 10)
         {
-          Serial.println(F("Right wall hit!"));
-          snakeReset(0);
-          return;
+          snakeSetSpeed(SNAKE_MOVE_MS_FAST);
         }
-        break;
-      default:
-        Serial.print(F(" [ERROR] "));
-        return;
-    } // end switch
+      }
+
+    }
+  } // end of apple eating
+
+  // Drawn by snakeRedrawDisplay() in the page passes
+
+  // Ticks that end the game aren't timed, they include the game over screen
+  unsigned long tickUs = snakeTickMicros() - tickStart;
+  gVault.snakeTicks++;
+  gVault.snakeTickTotalUs += tickUs;
+  if (tickUs > gVault.snakeTickMaxUs)
+  {
+    gVault.snakeTickMaxUs = tickUs;
+  }
+}
+
+// Snake autopilot: plays the game with nobody on the buttons, heading for
+// the nearest apple without hitting a wall or itself, so long dense games
+// can be run as a repeatable load on the game logic and the redraw path.
+// Toggled with snauto, or holding B and pressing A in snake mode.  Games it
+// has steered in never set the high score, or that challenge would be one
+// command away on any unlocked vault.
+
+#define SNAKE_BG_MODE BG_MODE_DRAWN_BY_snakeRedrawDisplay
 
-    // Did the snake hit the snake?
-    //uint8_t snakeLen = (gSnakeBufferPos >> 4) & 0xf + 1;
-    int snakeIndexToCheck = gSnakeBufferPos - 1;
-    // skip index 0, cause we can't hit the current head
-    for(int i = 1; i < gSnakeLen; i++)
+// Cells the move tick doesn't end the game in, walls as snakeMoveTick()
+// has them
+uint8_t snakeCellFree(struct Point const & p)
+{
+  if ( (p.x <= 0) || (p.x >= SNAKE_SCREEN_WIDTH - 1) || (p.y < 0) || (p.y >= SNAKE_SCREEN_HEIGHT) )
+  {
+    return 0;
+  }
+
+  // Everything but the head, the same segments the move tick checks
+  int index = gVault.snakeBufferPos;
+  for(int i = 1; i < gVault.snakeLen; i++)
+  {
+    index = (index == 0) ? MAX_SNAKE_LEN - 1 : index - 1;
+    if (p == gVault.snake[index])
     {
-      if (snakeIndexToCheck == -1)
-      {
-        // wrap around
-        snakeIndexToCheck = MAX_SNAKE_LEN - 1;
-      }
+      return 0;
+    }
+  }
+  return 1;
+}
 
-      if (*nextPos == gSnake[snakeIndexToCheck])
-      {
-        Serial.println(F("Snake hit"));
-        snakeReset(0);
-        return;
-      }
+struct Point snakeStep(struct Point p, uint8_t dir)
+{
+  switch (dir)
+  {
+    case SNAKE_UP:    p.y -= 1; break;
+    case SNAKE_DOWN:  p.y += 1; break;
+    case SNAKE_LEFT:  p.x -= 1; break;
+    case SNAKE_RIGHT: p.x += 1; break;
+  }
+  return p;
+}
+
+void snakeAutoSteer()
+{
+  struct Point head = gVault.snake[gVault.snakeBufferPos];
 
-        snakeIndexToCheck--;
+  // Nearest apple it can get to, apples can land in the wall columns
+  int8_t target = -1;
+  uint8_t targetDist = 0xff;
+  for(int i = 0; i < MAX_APPLES; i++)
+  {
+    struct Point const & a = gVault.apples[i];
+    if ( (a.x <= 0) || (a.x >= SNAKE_SCREEN_WIDTH - 1) )
+    {
+      continue;
     }
+    uint8_t dist = abs(a.x - head.x) + abs(a.y - head.y);
+    if (dist < targetDist)
+    {
+      targetDist = dist;
+      target = i;
+    }
+  }
 
-    // If we got here, we didn't hit anything
-    snakeDrawPixel(*nextPos);
-    snakeClearPixel(gSnake[snakeIndexToCheck]);
+  uint8_t bestDir = gVault.snakeDir;
+  uint16_t bestScore = 0xffff;
+  for(uint8_t dir = 0; dir < 4; dir++)
+  {
+    struct Point next = snakeStep(head, dir);
+    if (!snakeCellFree(next))
+    {
+      continue;
+    }
 
-    gSnakeBufferPos = nextBufferPos;
+    uint16_t score = 0;
+    if (target >= 0)
+    {
+      score = abs(gVault.apples[target].x - next.x) + abs(gVault.apples[target].y - next.y);
+    }
 
-    // Did the snake eat an apple?
-    for(int i = 0; i < 8; i++)
+    // One move of lookahead: don't go somewhere with no way out
+    uint8_t exits = 0;
+    for(uint8_t d = 0; d < 4; d++)
     {
-      if (gApples[i].x != -1)
-      {
-        if (*nextPos == gApples[i])
-        {
-          Serial.println(F("Yummy!!"));
-
-          gApples[i].x = -1;
-          gSnakeLen += 1;
-          if (gSnakeLen == SNAKE_LEN_MAX)
-          {
-            Serial.println(F("ANACONDA!!"));
-            gSnakeLen -= 1;
-          }
-
-          gSnakeScore += 1;
-          if (gSnakeScore > 10)
-          {
-            gSnakeSpeed = 0x3;
-          }
-
-          if (gSnakeScore > 25)
-          {
-            gSnakeSpeed = 0x1;
-          }
-        }
+      exits += snakeCellFree(snakeStep(next, d));
+    }
+    if (exits == 0)
+    {
+      score += 0x1000;
+    }
 
-      }
-    } // end of apple eating
+    // Keep going straight when it's a tie, fewer turns
+    if ( (score < bestScore) || ( (score == bestScore) && (dir == gVault.snakeDir) ) )
+    {
+      bestScore = score;
+      bestDir = dir;
+    }
+  }
 
-  } // end of snake moved
+  gVault.snakeDir = bestDir;
 
-  
-  // Draw everything
-  snakeRedrawDisplay();
+  // Even one move from the autopilot and the game doesn't count towards
+  // the high score challenge, however it ends
+  gVault.snakeAutoPlayed = 1;
+
+  // A game being played counts as somebody watching, the display idle
+  // policy would otherwise blank the load it's meant to be measuring
+  displayActivity();
+}
+
+void snakeAutoStart()
+{
+  gVault.snakeAuto = 1;
+  gVault.snakeAutoStartMs = millis();
+  gVault.snakeTicks = 0;
+  gVault.snakeTickMaxUs = 0;
+  gVault.snakeTickTotalUs = 0;
+  gVault.snakeGames = 0;
+  gVault.snakeBestScore = 0;
+
+  if (gVault.bgMode != SNAKE_BG_MODE)
+  {
+    setBgMode(SNAKE_BG_MODE);
+  }
+  Serial.println(F("Autopilot on"));
+}
+
+void snakeAutoToggle()
+{
+  if (gVault.snakeAuto)
+  {
+    gVault.snakeAuto = 0;
+    Serial.println(F("Autopilot off"));
+  }
+  else
+  {
+    snakeAutoStart();
+  }
+}
+
+void commandSnakeAuto()
+{
+#ifndef DEBUG_MODE
+  // Debug builds are for the bench, they can play locked
+  if (!gVault.snakeAuto && !modeAllowed(SNAKE_BG_MODE))
+  {
+    Serial.println(F("Vault is locked"));
+    return;
+  }
+#endif
+  snakeAutoToggle();
+}
+
+void commandSnakeStats()
+{
+  unsigned long ms = millis() - gVault.snakeAutoStartMs;
 
+  Serial.print(F("Autopilot: "));
+  Serial.println(gVault.snakeAuto ? F("on") : F("off"));
+  Serial.print(F("Ticks: "));
+  Serial.println(gVault.snakeTicks);
+  if (ms >= 1000)
+  {
+    Serial.print(F("Ticks/s: "));
+    Serial.println(gVault.snakeTicks / (ms / 1000));
+  }
+  if (gVault.snakeTicks)
+  {
+    Serial.print(F("Mean tick us: "));
+    Serial.println(gVault.snakeTickTotalUs / gVault.snakeTicks);
+  }
+  Serial.print(F("Max tick us: "));
+  Serial.println(gVault.snakeTickMaxUs);
+  Serial.print(F("Games: "));
+  Serial.println(gVault.snakeGames);
+  Serial.print(F("Best score: "));
+  Serial.println(max(gVault.snakeBestScore, gVault.snakeScore));
+  Serial.print(F("Length: "));
+  Serial.println(gVault.snakeLen);
 }
 
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Builds the vault firmware with arduino-cli and prints the path of the ELF.
+# Any arguments are passed to the compiler, e.g. -DDEBUG_MODE -DFAST_BOOT
+#
+# Needs the AVR core and the Adafruit display libraries installed:
+#   arduino-cli core install arduino:avr
+#   arduino-cli lib install "Adafruit SSD1306" "Adafruit GFX Library"
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+FW_DIR=$(dirname "$HERE")
+REPO=$(dirname "$FW_DIR")
+BUILD_DIR=${BUILD_DIR:-$FW_DIR/build}
+FQBN=${FQBN:-arduino:avr:uno}
+
+# The source lives as a .c file, arduino-cli wants a sketch folder
+SKETCH_DIR=$BUILD_DIR/vault
+mkdir -p "$SKETCH_DIR"
+cp "$FW_DIR/src_sanitized.c" "$SKETCH_DIR/vault.ino"
+
+arduino-cli compile --fqbn "$FQBN" --libraries "$REPO/libraries" \
+  --build-property "compiler.cpp.extra_flags=$*" \
+  --output-dir "$BUILD_DIR/out" "$SKETCH_DIR" >&2
+
+echo "$BUILD_DIR/out/vault.ino.elf"
@@ -0,0 +1,546 @@
+#include "board.h"
+
+#include <chrono>
+
+#include <SPI.h>
+#include <avr/sleep.h>
+
+static thread_local struct Board* gBoard = nullptr;
+
+thread_local volatile uint8_t MCUSR;
+thread_local volatile uint8_t WDTCSR;
+thread_local volatile uint8_t PCICR;
+thread_local volatile uint8_t PCMSK0;
+thread_local volatile uint8_t PCMSK1;
+thread_local volatile uint8_t PCMSK2;
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+void boardSelect(struct Board* b)
+{
+  gBoard = b;
+}
+
+struct Board* boardSelected()
+{
+  return gBoard;
+}
+
+// --- Time ----------------------------------------------------------------
+
+unsigned long millis()
+{
+  return gBoard->nowUs / 1000;
+}
+
+unsigned long micros()
+{
+  return gBoard->nowUs;
+}
+
+unsigned long hostMicros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// --- Watchdog ------------------------------------------------------------
+
+void wdt_enable(uint8_t timeout)
+{
+  // 2048 cycles of the 128 kHz watchdog oscillator, doubled per step
+  gBoard->wdtTimeoutUs = 16000ULL << timeout;
+  gBoard->wdtFedUs = gBoard->nowUs;
+}
+
+void wdt_disable()
+{
+  gBoard->wdtTimeoutUs = 0;
+}
+
+void wdt_reset()
+{
+  struct Board* b = gBoard;
+  if (b->wdtTimeoutUs && (b->nowUs - b->wdtFedUs > b->wdtMaxGapUs))
+  {
+    b->wdtMaxGapUs = b->nowUs - b->wdtFedUs;
+  }
+  b->wdtFedUs = b->nowUs;
+}
+
+static void boardIdle()
+{
+  if (gBoard->onIdle)
+  {
+    gBoard->onIdle(gBoard);
+  }
+}
+
+void delay(unsigned long ms)
+{
+  gBoard->nowUs += (uint64_t) ms * 1000;
+  boardIdle();
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  gBoard->nowUs += us;
+}
+
+void hostSleep()
+{
+  gBoard->sleeps++;
+  if (gBoard->rxPos < gBoard->rx.size())
+  {
+    // The byte that arrived while we were deciding to sleep wakes us at once
+    return;
+  }
+
+  // Otherwise the next millis() tick does
+  gBoard->nowUs = (gBoard->nowUs / 1000 + 1) * 1000;
+  boardIdle();
+}
+
+long random(long howBig)
+{
+  if (howBig <= 0)
+  {
+    return 0;
+  }
+
+  // xorshift32, per board so runs are repeatable whatever the threads do
+  uint32_t x = gBoard->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  gBoard->rng = x;
+  return x % howBig;
+}
+
+long random(long howSmall, long howBig)
+{
+  return (howSmall >= howBig) ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+void randomSeed(unsigned long seed)
+{
+  if (seed != 0)
+  {
+    gBoard->rng = seed;
+  }
+}
+
+// --- EEPROM --------------------------------------------------------------
+
+uint8_t eeprom_read_byte(const uint8_t* addr)
+{
+  return gBoard->eeprom[(uintptr_t) addr % BOARD_EEPROM_LEN];
+}
+
+void eeprom_update_byte(uint8_t* addr, uint8_t val)
+{
+  uint8_t* cell = &gBoard->eeprom[(uintptr_t) addr % BOARD_EEPROM_LEN];
+  if (*cell != val)
+  {
+    *cell = val;
+    gBoard->eepromWrites++;
+  }
+}
+
+// --- GPIO ----------------------------------------------------------------
+
+struct HostPort* hostBoardPort(uint8_t n)
+{
+  return &gBoard->ports[n];
+}
+
+static struct HostPort* pinPort(uint8_t pin, uint8_t* mask)
+{
+  uint8_t n = (pin < 8) ? 0 : ( (pin < 14) ? 1 : 2 );
+  *mask = 1 << ( (pin < 8) ? pin : ( (pin < 14) ? pin - 8 : pin - 14 ) );
+  return &gBoard->ports[n];
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  uint8_t mask;
+  struct HostPort* p = pinPort(pin, &mask);
+  if (mode == OUTPUT)
+  {
+    p->ddr |= mask;
+  }
+  else
+  {
+    p->ddr &= ~mask;
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  uint8_t mask;
+  return (pinPort(pin, &mask)->pin & mask) ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  uint8_t mask;
+  struct HostPort* p = pinPort(pin, &mask);
+  if (val)
+  {
+    p->port |= mask;
+  }
+  else
+  {
+    p->port &= ~mask;
+  }
+}
+
+void boardPress(struct Board* b, uint8_t pin, bool down)
+{
+  struct Board* prev = gBoard;
+  gBoard = b;
+
+  uint8_t mask;
+  struct HostPort* p = pinPort(pin, &mask);
+  if (down)
+  {
+    p->pin &= ~mask;
+  }
+  else
+  {
+    p->pin |= mask;
+  }
+
+  gBoard = prev;
+}
+
+// --- UART ----------------------------------------------------------------
+
+size_t Print::write(const uint8_t* buf, size_t len)
+{
+  size_t n = 0;
+  while ( (n < len) && write(buf[n]) )
+  {
+    n++;
+  }
+  return n;
+}
+
+size_t Print::printNumber(unsigned long n, int base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char* str = buf + sizeof(buf) - 1;
+  *str = 0;
+
+  if (base < 2)
+  {
+    base = 10;
+  }
+
+  do
+  {
+    int digit = n % base;
+    *--str = (digit < 10) ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while (n);
+
+  return write(str);
+}
+
+size_t Print::printSigned(long n, int base)
+{
+  if ( (base == DEC) && (n < 0) )
+  {
+    return write((uint8_t) '-') + printNumber(-(unsigned long) n, DEC);
+  }
+  return printNumber(n, base);
+}
+
+void HardwareSerial::begin(unsigned long)
+{
+}
+
+int HardwareSerial::available()
+{
+  return gBoard->rx.size() - gBoard->rxPos;
+}
+
+int HardwareSerial::read()
+{
+  if (gBoard->rxPos >= gBoard->rx.size())
+  {
+    return -1;
+  }
+  return (uint8_t) gBoard->rx[gBoard->rxPos++];
+}
+
+int HardwareSerial::peek()
+{
+  if (gBoard->rxPos >= gBoard->rx.size())
+  {
+    return -1;
+  }
+  return (uint8_t) gBoard->rx[gBoard->rxPos];
+}
+
+static uint64_t txQueuedBytes()
+{
+  if (gBoard->txIdleUs <= gBoard->nowUs)
+  {
+    return 0;
+  }
+  return (gBoard->txIdleUs - gBoard->nowUs + BOARD_UART_BYTE_US - 1) / BOARD_UART_BYTE_US;
+}
+
+int HardwareSerial::availableForWrite()
+{
+  uint64_t queued = txQueuedBytes();
+  return (queued >= BOARD_UART_TX_BUFFER - 1) ? 0 : BOARD_UART_TX_BUFFER - 1 - queued;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  struct Board* b = gBoard;
+  uint64_t start = (b->txIdleUs > b->nowUs) ? b->txIdleUs : b->nowUs;
+  b->txIdleUs = start + BOARD_UART_BYTE_US;
+
+  // A full buffer blocks the caller until a byte has gone out
+  uint64_t maxBacklogUs = (uint64_t) (BOARD_UART_TX_BUFFER - 1) * BOARD_UART_BYTE_US;
+  if (b->txIdleUs - b->nowUs > maxBacklogUs)
+  {
+    b->txStats.stalls++;
+    b->nowUs = b->txIdleUs - maxBacklogUs;
+  }
+
+  b->tx.push_back((char) c);
+  b->txBytes++;
+  b->txStats.bytes++;
+  return 1;
+}
+
+void boardType(struct Board* b, std::string const & text)
+{
+  if (b->rxPos == b->rx.size())
+  {
+    b->rx.clear();
+    b->rxPos = 0;
+  }
+  b->rx += text;
+
+  b->rxStats.bytes += text.size();
+  size_t waiting = b->rx.size() - b->rxPos;
+  if (waiting > b->rxStats.peak)
+  {
+    b->rxStats.peak = (waiting < 255) ? waiting : 255;
+  }
+}
+
+uint8_t serialLines()
+{
+  uint8_t lines = 0;
+  for (size_t i = gBoard->rxPos; i < gBoard->rx.size(); i++)
+  {
+    if ( (gBoard->rx[i] == '\n') || (gBoard->rx[i] == '\r') )
+    {
+      lines++;
+    }
+  }
+  return lines;
+}
+
+void serialGetStats(struct SerialRxStats* out)
+{
+  *out = gBoard->rxStats;
+}
+
+SerialDiag& serialDiag()
+{
+  return gBoard->diag;
+}
+
+void serialGetTxStats(struct SerialTxStats* out)
+{
+  *out = gBoard->txStats;
+}
+
+void serialResetStats()
+{
+  memset(&gBoard->rxStats, 0, sizeof(gBoard->rxStats));
+  memset(&gBoard->txStats, 0, sizeof(gBoard->txStats));
+  Diag.resetStats();
+}
+
+std::string boardCollect(struct Board* b)
+{
+  std::string out;
+  out.swap(b->tx);
+  return out;
+}
+
+// --- SPI -----------------------------------------------------------------
+
+uint8_t SPIClass::transfer(uint8_t)
+{
+  // 8 MHz SCK
+  gBoard->spiBytes++;
+  gBoard->nowUs += 1;
+  return 0;
+}
+
+// --- I2C: a DS1307 and nothing else --------------------------------------
+
+static uint8_t bcdToBin(uint8_t v)
+{
+  return (v >> 4) * 10 + (v & 0xf);
+}
+
+static uint8_t binToBcd(uint8_t v)
+{
+  return ( (v / 10) << 4 ) | (v % 10);
+}
+
+// Advances the time registers by whatever whole seconds have gone by
+static void rtcTick(struct Board* b)
+{
+  uint64_t secs = (b->nowUs - b->rtcTickUs) / 1000000;
+  b->rtcTickUs += secs * 1000000;
+
+  if (b->rtc[0] & 0x80)
+  {
+    // Clock halt bit set, the oscillator isn't running
+    return;
+  }
+
+  while (secs--)
+  {
+    uint8_t sec = bcdToBin(b->rtc[0] & 0x7f) + 1;
+    if (sec < 60)
+    {
+      b->rtc[0] = binToBcd(sec);
+      continue;
+    }
+    b->rtc[0] = 0;
+
+    uint8_t min = bcdToBin(b->rtc[1] & 0x7f) + 1;
+    if (min < 60)
+    {
+      b->rtc[1] = binToBcd(min);
+      continue;
+    }
+    b->rtc[1] = 0;
+
+    uint8_t hrReg = b->rtc[2];
+    if (hrReg & 0x40)
+    {
+      // 12 hour mode, bit 5 is PM
+      uint8_t hr = bcdToBin(hrReg & 0x1f);
+      uint8_t pm = hrReg & 0x20;
+      if (hr == 11)
+      {
+        pm ^= 0x20;
+      }
+      hr = (hr == 12) ? 1 : hr + 1;
+      b->rtc[2] = 0x40 | pm | binToBcd(hr);
+    }
+    else
+    {
+      b->rtc[2] = binToBcd( (bcdToBin(hrReg & 0x3f) + 1) % 24 );
+    }
+  }
+}
+
+static uint8_t i2cFinish(uint64_t startUs, uint8_t status)
+{
+  struct I2cStats* st = &gBoard->i2c;
+  st->transfers++;
+  st->lastUs = gBoard->nowUs - startUs;
+  if (st->lastUs > st->maxUs)
+  {
+    st->maxUs = st->lastUs;
+  }
+  if (status != I2C_OK)
+  {
+    st->failures++;
+    st->lastError = status;
+  }
+  return status;
+}
+
+// 100 kHz, 9 clocks a byte
+static void i2cBusTime(uint8_t bytes)
+{
+  gBoard->nowUs += (uint64_t) (bytes + 1) * 90;
+}
+
+void i2cBegin()
+{
+}
+
+uint8_t i2cWrite(uint8_t addr, uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+  uint64_t start = gBoard->nowUs;
+  struct Board* b = gBoard;
+
+  if (addr != BOARD_RTC_ADDR)
+  {
+    i2cBusTime(0);
+    return i2cFinish(start, I2C_NAK_ADDR);
+  }
+
+  rtcTick(b);
+  b->rtcPtr = reg % BOARD_RTC_LEN;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    if (b->rtcPtr == 0)
+    {
+      // Writing the seconds restarts the count down to the next tick
+      b->rtcTickUs = b->nowUs;
+    }
+    b->rtc[b->rtcPtr] = buf[i] & ~b->rtcStuckLow[b->rtcPtr];
+    b->rtcPtr = (b->rtcPtr + 1) % BOARD_RTC_LEN;
+  }
+
+  i2cBusTime(len + 1);
+  return i2cFinish(start, I2C_OK);
+}
+
+uint8_t i2cRead(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+  uint64_t start = gBoard->nowUs;
+  struct Board* b = gBoard;
+
+  if (addr != BOARD_RTC_ADDR)
+  {
+    i2cBusTime(0);
+    return i2cFinish(start, I2C_NAK_ADDR);
+  }
+
+  rtcTick(b);
+  b->rtcPtr = reg % BOARD_RTC_LEN;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    buf[i] = b->rtc[b->rtcPtr];
+    b->rtcPtr = (b->rtcPtr + 1) % BOARD_RTC_LEN;
+  }
+
+  i2cBusTime(1);
+  i2cBusTime(len);
+  return i2cFinish(start, I2C_OK);
+}
+
+uint8_t i2cRecover()
+{
+  gBoard->i2c.recoveries++;
+  return 1;
+}
+
+const struct I2cStats* i2cGetStats()
+{
+  return &gBoard->i2c;
+}
+
+void i2cResetStats()
+{
+  memset(&gBoard->i2c, 0, sizeof(gBoard->i2c));
+}
@@ -0,0 +1,84 @@
+// One simulated vault board: everything the firmware would reach through
+// hardware.  Each worker thread selects the board it is stepping with
+// boardSelect(), and the host Arduino / I2cBus stand-ins in host/ act on
+// that board only, so boards on different threads never share anything.
+#ifndef FLEET_SIM_BOARD_H
+#define FLEET_SIM_BOARD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include <Arduino.h>
+#include <I2cBus.h>
+#include <SerialRing.h>
+
+#define BOARD_RTC_ADDR 0x68
+#define BOARD_RTC_LEN 64
+#define BOARD_EEPROM_LEN 1024
+
+// 9600 8N1, 10 bit times a byte
+#define BOARD_UART_BYTE_US 1042
+#define BOARD_UART_TX_BUFFER 64
+
+struct Board
+{
+  Board() { memset(eeprom, 0xff, sizeof(eeprom)); }
+
+  uint64_t nowUs = 0;
+
+  // UART: rx is what the host has typed and the firmware hasn't read,
+  // tx is what the firmware has printed and the host hasn't collected.
+  // Transmitting is paced at the baud rate through a 64 byte buffer, like
+  // HardwareSerial, so a chatty command costs the time it would on a board.
+  std::string rx;
+  size_t rxPos = 0;
+  std::string tx;
+  uint64_t txIdleUs = 0;     // when the last queued byte finishes sending
+  uint64_t txBytes = 0;
+  struct SerialRxStats rxStats = {};
+  struct SerialTxStats txStats = {};
+  SerialDiag diag{Serial};
+
+  // DS1307: 7 clock registers, control, then battery backed RAM
+  uint8_t rtc[BOARD_RTC_LEN] = {};
+  uint8_t rtcPtr = 0;
+  uint64_t rtcTickUs = 0;    // virtual time the seconds register last advanced
+  uint8_t rtcStuckLow[BOARD_RTC_LEN] = {};  // bad RAM: these bits always read 0
+  struct I2cStats i2c = {};
+
+  // ATmega328P EEPROM, erased
+  uint8_t eeprom[BOARD_EEPROM_LEN];
+  uint32_t eepromWrites = 0;
+
+  // Buttons are active low with pull-ups, so PIN reads all ones until the
+  // host presses something
+  struct HostPort ports[3] = { { 0xff, 0, 0 }, { 0xff, 0, 0 }, { 0xff, 0, 0 } };
+
+  // Watchdog: armed with its timeout by wdt_enable(), and the longest the
+  // firmware has gone without a wdt_reset() since
+  uint64_t wdtTimeoutUs = 0;
+  uint64_t wdtFedUs = 0;
+  uint64_t wdtMaxGapUs = 0;
+
+  uint64_t spiBytes = 0;
+  uint64_t sleeps = 0;
+  uint32_t rng = 0x1234567;
+
+  // Called whenever the firmware waits (delay(), idle sleep), which is
+  // where a real board would see serial bytes come and go mid command
+  void (*onIdle)(struct Board* b) = nullptr;
+  void* owner = nullptr;
+};
+
+void boardSelect(struct Board* b);
+struct Board* boardSelected();
+
+// Host side of the UART
+void boardType(struct Board* b, std::string const & text);
+std::string boardCollect(struct Board* b);
+
+// Holds the button on Arduino pin pin down (or lets it go)
+void boardPress(struct Board* b, uint8_t pin, bool down);
+
+#endif
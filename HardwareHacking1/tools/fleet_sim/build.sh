@@ -0,0 +1,33 @@
+#!/bin/bash
+# Builds the fleet simulator: the vault firmware compiled for the host
+# against the stand-ins in host/, plus the fleet around it.  Prints the
+# path of the binary.  Any arguments are passed to the compiler, e.g.
+# -DFAST_BOOT.  Always a DEBUG_MODE build, provisioning needs it.
+
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+FW_DIR=$(dirname "$(dirname "$HERE")")
+REPO=$(dirname "$FW_DIR")
+LIBS=$REPO/libraries
+BUILD_DIR=${BUILD_DIR:-$FW_DIR/build/fleet_sim}
+CXX=${CXX:-g++}
+
+mkdir -p "$BUILD_DIR"
+python3 "$HERE/sketch_protos.py" "$FW_DIR/src_sanitized.c" > "$BUILD_DIR/vault_sketch.cpp"
+
+# The host has no TWI, so the display goes over the (counted) SPI stand-in.
+# The sketch is built the way the Arduino builder builds it: -fpermissive.
+FLAGS="-std=gnu++17 -O2 -pthread -DVAULT_HOST -DDISPLAY_SPI -DDEBUG_MODE -DSOFT_TIMER_LOCAL=thread_local"
+# Warnings are on so new ones show up; only kinds the sketch has always had
+# (char mode and buffer indexes, string literals passed as char*, a const
+# on returned pointers, unused clock reads) are turned off.
+WARN="-Wall -Wextra -Wno-char-subscripts -Wno-write-strings -Wno-ignored-qualifiers -Wno-unused-variable"
+INCLUDES="-I$HERE/host -I$HERE -I$BUILD_DIR -I$LIBS/FastPin -I$LIBS/TinyFmt -I$LIBS/PageCanvas -I$LIBS/SoftTimer -I$LIBS/I2cBus -I$LIBS/SerialRing"
+
+$CXX $FLAGS $INCLUDES -fpermissive $WARN "$@" -c "$HERE/vault_host.cpp" -o "$BUILD_DIR/vault_host.o"
+$CXX $FLAGS $INCLUDES "$@" -o "$BUILD_DIR/fleet_sim" \
+  "$HERE/fleet_sim.cpp" "$HERE/board.cpp" "$BUILD_DIR/vault_host.o" \
+  "$LIBS/TinyFmt/TinyFmt.cpp" "$LIBS/PageCanvas/PageCanvas.cpp" "$LIBS/SoftTimer/SoftTimer.cpp" "$LIBS/SerialRing/SerialDiag.cpp"
+
+echo "$BUILD_DIR/fleet_sim"
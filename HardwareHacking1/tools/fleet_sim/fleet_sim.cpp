@@ -0,0 +1,760 @@
+/**************************************************************************
+ Vault fleet simulator
+
+ Runs thousands of vaults in one process: the real firmware (built for the
+ host by build.sh), one struct Vault each, on simulated boards with their
+ own clock, UART, DS1307 and buttons (board.h).  A pool of worker threads
+ shares the vaults out; each worker steps its vaults a slice of virtual
+ time at a time, so the whole fleet advances together and a 9600 baud
+ conversation takes as long, in virtual time, as it would on a desk.
+
+ Every vault goes through the same session vault_provision has with a
+ board (wrflgs, wrpins, setchl, then read it all back and check it), then
+ keeps being polled with the monitoring commands while somebody pushes
+ its buttons, until it has run for --seconds.
+
+ Build (needs g++, python3):
+   ./build.sh
+
+ Provision and soak 5000 vaults for a simulated minute each:
+   build/fleet_sim --vaults 5000 --seconds 60
+
+ --bad-rtc N gives every Nth vault a stuck bit in its RTC RAM, so the
+ read-back check has something to catch.  --snake N has every Nth vault
+ play snake on autopilot once it is provisioned, as a sustained load.  --pty N puts the first N vaults
+ on ptys instead, in real time, for driving with the real tools:
+   build/fleet_sim --vaults 0 --pty 16 --seconds 600 &
+   ./vault_provision --ports /dev/pts/5,... --flags a,b,c --pins 1111,2222,3333,4444
+ **************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "vault_host.h"
+
+#define NUM_FLAGS 3
+#define NUM_PINS 4
+
+#define UP_BUTTON 3
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+  int vaults = 1000;
+  int threads = 0;             // 0: one per core
+  int seconds = 30;            // per vault, virtual (real time for --pty)
+  int sliceMs = 100;           // how far a worker runs one vault before the next
+  int replyTimeoutMs = 5000;   // virtual
+  int monitorMs = 2000;        // virtual, between monitoring commands
+  int badRtcEvery = 0;
+  int snakeEvery = 0;
+  int pty = 0;
+};
+
+/**
+ * The session a vault has with the fleet, driven from the vault's own
+ * idle points so replies can arrive mid command, as they would over a
+ * real serial line.  Each step types its text, then waits for the first
+ * needle (success) or any other (failure).
+ */
+struct Step
+{
+  std::string send;
+  std::vector<std::string> expect;
+  bool capture = false;
+  int tapPin = -1;
+};
+
+class Session
+{
+public:
+  Session(int index, Options const & opts) : mIndex(index), mOpts(opts)
+  {
+    char buf[16];
+    for (int i = 0; i < NUM_FLAGS; i++)
+    {
+      snprintf(buf, sizeof(buf), "v%05d-f%d", index % 100000, i);
+      mFlags[i] = buf;
+    }
+    for (int i = 0; i < NUM_PINS; i++)
+    {
+      // 4 digits, setPin checks 4 digit positions
+      mPins[i] = 1000 + (index * 7 + i * 1361) % 9000;
+    }
+    mMode = index % 4;
+    mSnake = opts.snakeEvery > 0 && index % opts.snakeEvery == opts.snakeEvery - 1;
+
+    buildProvisioning();
+  }
+
+  // True once provisioning is over, either way
+  bool provisioned() const { return mPhase != PHASE_PROVISION; }
+  bool ok() const { return mError.empty(); }
+  std::string const & error() const { return mError; }
+  uint64_t provisionUs() const { return mProvisionUs; }
+  unsigned long commands() const { return mCommands; }
+
+  void poll(struct Board* b)
+  {
+    if (!b->tx.empty())
+      mRx += boardCollect(b);
+
+    uint64_t now = b->nowUs;
+    if (mReleaseUs && now >= mReleaseUs)
+    {
+      boardPress(b, mTapPin, false);
+      mReleaseUs = 0;
+    }
+
+    while (mPhase != PHASE_DONE)
+    {
+      if (mStep >= mSteps.size())
+      {
+        finishSteps(now);
+        continue;
+      }
+
+      Step const & step = mSteps[mStep];
+      if (!mStarted)
+      {
+        if (now < mStartUs)
+          break;
+        startStep(b, step, now);
+        if (step.expect.empty())
+        {
+          nextStep(now);
+          continue;
+        }
+      }
+
+      size_t bestPos = std::string::npos;
+      int bestIdx = -1;
+      for (size_t i = 0; i < step.expect.size(); i++)
+      {
+        size_t p = mRx.find(step.expect[i]);
+        if (p != std::string::npos && p < bestPos)
+        {
+          bestPos = p;
+          bestIdx = (int) i;
+        }
+      }
+
+      if (bestIdx < 0)
+      {
+        if (now > mDeadlineUs)
+          fail("timed out waiting for '" + step.expect[0] + "'");
+        else if (mRx.size() > 8192)
+          mRx.erase(0, mRx.size() - 1024);  // nothing is looking at it
+        break;
+      }
+
+      if (bestIdx > 0)
+      {
+        fail("got '" + step.expect[bestIdx] + "' after '" + step.send.substr(0, step.send.find('\n')) + "'");
+        break;
+      }
+
+      size_t end = bestPos + step.expect[0].size();
+      if (step.capture)
+        mCaptured += mRx.substr(0, end);
+      mRx.erase(0, end);
+      nextStep(now);
+    }
+
+    if (mPhase == PHASE_DONE && mRx.size() > 8192)
+      mRx.clear();
+  }
+
+private:
+  enum { PHASE_PROVISION, PHASE_MONITOR, PHASE_DONE };
+
+  void buildProvisioning()
+  {
+    std::vector<std::string> const pinReply = { "to external RAM", "nvalid", "Error" };
+    std::vector<std::string> const nak = { "Done", "No matching handler" };
+
+    for (int i = 0; i < NUM_FLAGS; i++)
+    {
+      mSteps.push_back({ i == 0 ? "wrflgs\n" : "", { "Give me a flag", "No matching handler" } });
+      mSteps.push_back({ mFlags[i] + "\n", nak });
+    }
+
+    for (int i = 0; i < NUM_PINS; i++)
+    {
+      mSteps.push_back({ i == 0 ? "wrpins\n" : "", { "Give me a pin" } });
+      mSteps.push_back({ std::to_string(mPins[i]) + "\n", pinReply });
+    }
+
+    mSteps.push_back({ "setchl\n", { "challenge mode (0-3)", "No matching handler" } });
+    mSteps.push_back({ std::to_string(mMode) + "\n", { "Challenge mode set to", "Invalid" } });
+
+    Step s;
+    s = { "getflg\n", { "Flag 3:" } };
+    s.capture = true;
+    mSteps.push_back(s);
+    s = { "getpns\n", { "Pin 3: " } };
+    s.capture = true;
+    mSteps.push_back(s);
+    s = { "", { "\n" } };
+    s.capture = true;
+    mSteps.push_back(s);
+    mSteps.push_back({ "ver\n", { "DEBUG! " } });
+    s = { "", { "\n" } };
+    s.capture = true;
+    mSteps.push_back(s);
+
+    if (mSnake)
+      mSteps.push_back({ "snauto\n", { "Autopilot on", "No matching handler" } });
+  }
+
+  void buildMonitoring()
+  {
+    // One of each, then a push of the up button so the screens change
+    static char const * const cmds[][2] = {
+      { "flight\n", "Slowest loop ms: " },
+      { "i2c\n", "Last error: " },
+      { "idle\n", "Wakeups: " },
+      { "disp\n", "Push errors: " },
+      { "serial\n", "Diag bytes lost: " },
+      { "boottm\n", "frame: " },
+    };
+
+    mSteps.clear();
+    for (auto const & c : cmds)
+      mSteps.push_back({ c[0], { c[1], "No matching handler" } });
+
+    Step tap;
+    tap.tapPin = UP_BUTTON;
+    mSteps.push_back(tap);
+  }
+
+  void startStep(struct Board* b, Step const & step, uint64_t now)
+  {
+    if (mPhase == PHASE_MONITOR)
+      mRx.clear();   // whatever the last command printed after its needle
+
+    if (!step.send.empty())
+    {
+      boardType(b, step.send);
+      if (step.send.size() > 1 && std::isalpha((unsigned char) step.send[0]) && step.send.find('\n') != std::string::npos)
+        mCommands++;
+    }
+
+    if (step.tapPin >= 0)
+    {
+      boardPress(b, step.tapPin, true);
+      mTapPin = step.tapPin;
+      mReleaseUs = now + 100000;
+    }
+
+    mStarted = true;
+    mDeadlineUs = now + (uint64_t) mOpts.replyTimeoutMs * 1000;
+  }
+
+  void nextStep(uint64_t now)
+  {
+    mStep++;
+    mStarted = false;
+    if (mPhase == PHASE_MONITOR)
+      mStartUs = now + (uint64_t) mOpts.monitorMs * 1000;
+  }
+
+  void finishSteps(uint64_t now)
+  {
+    if (mPhase == PHASE_PROVISION)
+    {
+      mProvisionUs = now;
+      verify();
+      if (mPhase == PHASE_DONE)
+        return;
+      mPhase = PHASE_MONITOR;
+      buildMonitoring();
+    }
+    mStep = 0;
+    mStarted = false;
+    mStartUs = now + (uint64_t) mOpts.monitorMs * 1000;
+  }
+
+  void verify()
+  {
+    std::regex flagRe("Flag (\\d): wildcat\\{([^}]*)\\}");
+    int flagsSeen = 0;
+    for (std::sregex_iterator it(mCaptured.begin(), mCaptured.end(), flagRe), end; it != end; ++it)
+    {
+      int idx = std::stoi((*it)[1]);
+      if (idx >= NUM_FLAGS)
+        continue;
+      if ((*it)[2] != mFlags[idx])
+        return fail("flag " + std::to_string(idx) + " reads back as '" + (*it)[2].str() + "'");
+      flagsSeen++;
+    }
+    if (flagsSeen != NUM_FLAGS)
+      return fail("only " + std::to_string(flagsSeen) + " flags read back");
+
+    std::regex pinRe("Pin (\\d): (\\d+)");
+    int pinsSeen = 0;
+    for (std::sregex_iterator it(mCaptured.begin(), mCaptured.end(), pinRe), end; it != end; ++it)
+    {
+      int idx = std::stoi((*it)[1]);
+      if (std::stoul((*it)[2]) != mPins[idx])
+        return fail("pin " + std::to_string(idx) + " reads back as " + (*it)[2].str());
+      pinsSeen++;
+    }
+    if (pinsSeen != NUM_PINS)
+      return fail("only " + std::to_string(pinsSeen) + " pins read back");
+
+    // The last capture is the rest of the ver line
+    size_t lastLine = mCaptured.find_last_of('\n', mCaptured.size() - 2);
+    int mode = std::atoi(mCaptured.c_str() + (lastLine == std::string::npos ? 0 : lastLine + 1));
+    if (mode != mMode)
+      return fail("challenge mode reads back as " + std::to_string(mode));
+
+    mCaptured.clear();
+  }
+
+  void fail(std::string const & why)
+  {
+    if (mError.empty())
+      mError = why;
+    if (mPhase == PHASE_PROVISION)
+      mProvisionUs = 0;
+    mPhase = PHASE_DONE;
+  }
+
+  int mIndex;
+  Options const & mOpts;
+  std::string mFlags[NUM_FLAGS];
+  unsigned long mPins[NUM_PINS];
+  int mMode;
+  bool mSnake;
+
+  int mPhase = PHASE_PROVISION;
+  std::vector<Step> mSteps;
+  size_t mStep = 0;
+  bool mStarted = false;
+  uint64_t mStartUs = 0;
+  uint64_t mDeadlineUs = 0;
+  uint64_t mProvisionUs = 0;
+  uint64_t mReleaseUs = 0;
+  int mTapPin = -1;
+  unsigned long mCommands = 0;
+  std::string mRx;
+  std::string mCaptured;
+  std::string mError;
+};
+
+struct SimVault
+{
+  int index;
+  struct Board board;
+  struct Vault* vault = nullptr;
+  std::unique_ptr<Session> session;
+
+  // --pty vaults only
+  int ptyMaster = -1;
+  int ptySlave = -1;
+  std::string ptyPath;
+  Clock::time_point ptyStart;
+
+  ~SimVault()
+  {
+    if (vault)
+      vaultDelete(vault);
+    if (ptySlave >= 0)
+      close(ptySlave);
+    if (ptyMaster >= 0)
+      close(ptyMaster);
+  }
+
+  void select()
+  {
+    boardSelect(&board);
+    vaultSelect(vault);
+  }
+};
+
+static void sessionIdle(struct Board* b)
+{
+  static_cast<SimVault*>(b->owner)->session->poll(b);
+}
+
+struct WorkerResult
+{
+  unsigned long long passes = 0;
+  unsigned long long virtualUs = 0;
+};
+
+static void runWorker(std::vector<SimVault*> mine, Options const & opts, WorkerResult* res)
+{
+  uint64_t const endUs = (uint64_t) opts.seconds * 1000000;
+  uint64_t const sliceUs = (uint64_t) opts.sliceMs * 1000;
+
+  for (SimVault* v : mine)
+  {
+    v->select();
+    vaultBoot();
+    v->session->poll(&v->board);
+  }
+
+  for (uint64_t sliceEnd = sliceUs; ; sliceEnd += sliceUs)
+  {
+    bool running = false;
+    for (SimVault* v : mine)
+    {
+      if (v->board.nowUs >= endUs)
+        continue;
+      running = true;
+
+      v->select();
+      uint64_t until = std::min(sliceEnd, endUs);
+      while (v->board.nowUs < until)
+      {
+        uint64_t before = v->board.nowUs;
+        vaultPass();
+        v->session->poll(&v->board);
+        res->passes++;
+        res->virtualUs += v->board.nowUs - before;
+      }
+    }
+
+    if (!running)
+      break;
+  }
+
+  boardSelect(nullptr);
+  vaultSelect(nullptr);
+}
+
+// --- Real time vaults on ptys --------------------------------------------
+
+static std::atomic<bool> gPtyStop(false);
+
+static bool openPty(SimVault* v)
+{
+  v->ptyMaster = posix_openpt(O_RDWR | O_NOCTTY);
+  if (v->ptyMaster < 0 || grantpt(v->ptyMaster) != 0 || unlockpt(v->ptyMaster) != 0)
+    return false;
+
+  v->ptyPath = ptsname(v->ptyMaster);
+
+  // Hold the slave open and raw, same as vault_provision's fake boards
+  v->ptySlave = ::open(v->ptyPath.c_str(), O_RDWR | O_NOCTTY);
+  struct termios tio;
+  tcgetattr(v->ptySlave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(v->ptySlave, TCSANOW, &tio);
+
+  fcntl(v->ptyMaster, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+static void ptyIdle(struct Board* b)
+{
+  SimVault* v = static_cast<SimVault*>(b->owner);
+
+  std::string out = boardCollect(b);
+  size_t pos = 0;
+  while (pos < out.size())
+  {
+    ssize_t n = write(v->ptyMaster, out.data() + pos, out.size() - pos);
+    if (n <= 0)
+      break;   // nobody reading and the pty buffer is full, drop it like a board would
+    pos += n;
+  }
+
+  char buf[64];
+  ssize_t n = read(v->ptyMaster, buf, sizeof(buf));
+  if (n > 0)
+    boardType(b, std::string(buf, n));
+
+  // Don't let the vault's clock run ahead of the wall clock
+  auto due = v->ptyStart + std::chrono::microseconds(b->nowUs);
+  if (due > Clock::now())
+    std::this_thread::sleep_until(due);
+}
+
+static void runPtyVault(SimVault* v, Options const & opts)
+{
+  auto stop = v->ptyStart + std::chrono::seconds(opts.seconds);
+
+  v->select();
+  vaultBoot();
+  while (!gPtyStop && Clock::now() < stop)
+    vaultPass();
+}
+
+// The host has no watchdog to reset a vault, so a vault that went longer
+// than its timeout without feeding it is reported instead
+static bool watchdogWouldFire(SimVault* v)
+{
+  return v->board.wdtTimeoutUs && v->board.wdtMaxGapUs >= v->board.wdtTimeoutUs;
+}
+
+// --- Main ----------------------------------------------------------------
+
+static void usage(char const * prog)
+{
+  fprintf(stderr,
+    "Usage: %s [--vaults N] [--threads N] [--seconds S] [--slice MS]\n"
+    "          [--monitor MS] [--timeout MS] [--bad-rtc N] [--snake N] [--pty N]\n", prog);
+}
+
+int main(int argc, char** argv)
+{
+  Options opts;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      usage(argv[0]);
+      return 2;
+    }
+    int val = std::atoi(argv[++i]);
+
+    if (arg == "--vaults")
+      opts.vaults = val;
+    else if (arg == "--threads")
+      opts.threads = val;
+    else if (arg == "--seconds")
+      opts.seconds = val;
+    else if (arg == "--slice")
+      opts.sliceMs = std::max(1, val);
+    else if (arg == "--monitor")
+      opts.monitorMs = val;
+    else if (arg == "--timeout")
+      opts.replyTimeoutMs = val;
+    else if (arg == "--bad-rtc")
+      opts.badRtcEvery = val;
+    else if (arg == "--snake")
+      opts.snakeEvery = val;
+    else if (arg == "--pty")
+      opts.pty = val;
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (opts.threads <= 0)
+    opts.threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // Pty vaults first, numbered from 0, then the scripted fleet
+  std::vector<std::unique_ptr<SimVault>> ptyVaults;
+  for (int i = 0; i < opts.pty; i++)
+  {
+    SimVault* v = new SimVault();
+    ptyVaults.emplace_back(v);
+    v->index = i;
+    v->vault = vaultNew();
+    v->board.owner = v;
+    v->board.onIdle = ptyIdle;
+    if (!openPty(v))
+    {
+      fprintf(stderr, "Couldn't create pty for vault %d\n", i);
+      return 1;
+    }
+    printf("vault %d: %s\n", i, v->ptyPath.c_str());
+  }
+  fflush(stdout);
+
+  std::vector<std::unique_ptr<SimVault>> fleet;
+  int expectedBad = 0;
+  for (int i = 0; i < opts.vaults; i++)
+  {
+    SimVault* v = new SimVault();
+    fleet.emplace_back(v);
+    v->index = opts.pty + i;
+    v->vault = vaultNew();
+    v->board.owner = v;
+    v->board.onIdle = sessionIdle;
+    v->board.rng ^= v->index * 2654435761u;
+    v->session.reset(new Session(v->index, opts));
+
+    if (opts.badRtcEvery > 0 && i % opts.badRtcEvery == opts.badRtcEvery - 1)
+    {
+      // Bit 1 of the first character of flag 1 (0x1d, see the RTC RAM map)
+      v->board.rtcStuckLow[0x1d] = 0x02;
+      expectedBad++;
+    }
+  }
+
+  int const threads = std::min(opts.threads, std::max(1, opts.vaults));
+  printf("%d vault(s) on %d thread(s), %d s each%s\n", opts.vaults, threads, opts.seconds,
+         opts.pty ? ", plus pty vaults in real time" : "");
+  fflush(stdout);
+
+  auto start = Clock::now();
+
+  std::vector<std::thread> ptyThreads;
+  for (auto & v : ptyVaults)
+  {
+    v->ptyStart = start;
+    ptyThreads.emplace_back(runPtyVault, v.get(), std::cref(opts));
+  }
+
+  std::vector<WorkerResult> results(threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads && opts.vaults > 0; t++)
+  {
+    std::vector<SimVault*> mine;
+    for (size_t i = t; i < fleet.size(); i += threads)
+      mine.push_back(fleet[i].get());
+    workers.emplace_back(runWorker, mine, std::cref(opts), &results[t]);
+  }
+
+  for (auto & w : workers)
+    w.join();
+  double fleetSecs = std::chrono::duration<double>(Clock::now() - start).count();
+
+  for (auto & t : ptyThreads)
+    t.join();
+
+  int ptyOverBudget = 0;
+  for (auto & v : ptyVaults)
+  {
+    if (watchdogWouldFire(v.get()))
+    {
+      printf("vault %d: went %llu ms without feeding the watchdog\n", v->index,
+             (unsigned long long) (v->board.wdtMaxGapUs / 1000));
+      ptyOverBudget++;
+    }
+  }
+
+  if (opts.vaults == 0)
+    return ptyOverBudget ? 1 : 0;
+
+  // Report
+  unsigned long long passes = 0;
+  unsigned long long virtualUs = 0;
+  for (auto const & r : results)
+  {
+    passes += r.passes;
+    virtualUs += r.virtualUs;
+  }
+
+  int failed = 0;
+  int unexpected = 0;
+  int listed = 0;
+  unsigned long commands = 0;
+  unsigned long long uartBytes = 0;
+  unsigned long long provisionUs = 0;
+  int provisioned = 0;
+  unsigned long worstLoopMs = 0;
+  int worstLoopVault = -1;
+  unsigned long long frames = 0;
+  unsigned long long displayErrors = 0;
+  int snakeVaults = 0;
+  unsigned long long snakeTicks = 0;
+  unsigned long snakeTickMaxUs = 0;
+  unsigned long snakeGames = 0;
+  unsigned int snakeBestScore = 0;
+
+  for (size_t i = 0; i < fleet.size(); i++)
+  {
+    SimVault* v = fleet[i].get();
+    bool bad = v->board.rtcStuckLow[0x1d] != 0;
+
+    v->select();
+    struct VaultStats st;
+    vaultStats(&st);
+    frames += st.displayPushCount;
+    displayErrors += st.displayPushErrors;
+    if (st.snakeAuto)
+    {
+      snakeVaults++;
+      snakeTicks += st.snakeTicks;
+      snakeTickMaxUs = std::max(snakeTickMaxUs, st.snakeTickMaxUs);
+      snakeGames += st.snakeGames;
+      snakeBestScore = std::max(snakeBestScore, (unsigned int) st.snakeBestScore);
+    }
+    if (st.loopMaxMs > worstLoopMs)
+    {
+      worstLoopMs = st.loopMaxMs;
+      worstLoopVault = v->index;
+    }
+
+    commands += v->session->commands();
+    uartBytes += v->board.txBytes;
+
+    if (watchdogWouldFire(v))
+    {
+      // Would have been reset, whatever the session saw
+      failed++;
+      unexpected++;
+      if (listed < 10)
+      {
+        printf("  vault %d: went %llu ms without feeding the watchdog\n", v->index,
+               (unsigned long long) (v->board.wdtMaxGapUs / 1000));
+        listed++;
+      }
+    }
+    else if (!v->session->ok())
+    {
+      failed++;
+      if (!bad)
+        unexpected++;
+      if (listed < 10 && (!bad || listed < 3))
+      {
+        printf("  vault %d: %s\n", v->index, v->session->error().c_str());
+        listed++;
+      }
+    }
+    else if (v->session->provisioned())
+    {
+      provisioned++;
+      provisionUs += v->session->provisionUs();
+      if (bad)
+        unexpected++;
+    }
+    else
+    {
+      // Ran out of time part way through provisioning
+      failed++;
+      unexpected++;
+      if (listed < 10)
+      {
+        printf("  vault %d: still provisioning after %d s\n", v->index, opts.seconds);
+        listed++;
+      }
+    }
+  }
+  boardSelect(nullptr);
+  vaultSelect(nullptr);
+
+  double vaultSecs = virtualUs / 1e6;
+  printf("%.2f s wall, %.0f vault-seconds simulated (%.0fx real time), %llu loop passes (%.0f/s)\n",
+         fleetSecs, vaultSecs, vaultSecs / fleetSecs, passes, passes / fleetSecs);
+  printf("provisioned %d, failed %d (%d expected from --bad-rtc), %.2f s to provision on average\n",
+         provisioned, failed, expectedBad, provisioned ? provisionUs / 1e6 / provisioned : 0.0);
+  printf("%lu commands, %llu bytes from the vaults, %llu frames (%llu push errors), slowest loop pass %lu ms (vault %d)\n",
+         commands, uartBytes, frames, displayErrors, worstLoopMs, worstLoopVault);
+  if (snakeVaults)
+  {
+    // Tick times are the host's CPU time, not an AVR's
+    printf("snake autopilot on %d vault(s): %llu ticks (%.1f/s each), %lu games, best score %u, max tick %lu us\n",
+           snakeVaults, snakeTicks, snakeTicks / (double) snakeVaults / opts.seconds,
+           snakeGames, snakeBestScore, snakeTickMaxUs);
+  }
+
+  return (unexpected || ptyOverBudget) ? 1 : 0;
+}
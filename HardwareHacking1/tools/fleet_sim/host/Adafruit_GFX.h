@@ -0,0 +1,97 @@
+// Host stand-in for the parts of Adafruit_GFX the vault draws with.  Shapes
+// go through drawPixel() like the real library; text only moves the
+// cursor, nobody looks at the pixels on the host.
+#ifndef FLEET_SIM_ADAFRUIT_GFX_H
+#define FLEET_SIM_ADAFRUIT_GFX_H
+
+#include <Arduino.h>
+
+class Adafruit_GFX : public Print
+{
+public:
+  Adafruit_GFX(int16_t w, int16_t h)
+    : WIDTH(w), HEIGHT(h), _width(w), _height(h) {}
+
+  virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+
+  virtual void fillScreen(uint16_t color)
+  {
+    fillRect(0, 0, _width, _height, color);
+  }
+
+  void drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color)
+  {
+    for (int16_t i = 0; i < w; i++)
+      drawPixel(x + i, y, color);
+  }
+
+  void drawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color)
+  {
+    for (int16_t i = 0; i < h; i++)
+      drawPixel(x, y + i, color);
+  }
+
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+  {
+    drawFastHLine(x, y, w, color);
+    drawFastHLine(x, y + h - 1, w, color);
+    drawFastVLine(x, y, h, color);
+    drawFastVLine(x + w - 1, y, h, color);
+  }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
+  {
+    for (int16_t i = 0; i < h; i++)
+      drawFastHLine(x, y + i, w, color);
+  }
+
+  size_t write(uint8_t c) override
+  {
+    if (c == '\n')
+    {
+      cursorX = 0;
+      cursorY += textSizeY * 8;
+    }
+    else if (c != '\r')
+    {
+      cursorX += textSizeX * 6;
+    }
+    return 1;
+  }
+  using Print::write;
+
+  void setCursor(int16_t x, int16_t y) { cursorX = x; cursorY = y; }
+  void setTextSize(uint8_t s) { setTextSize(s, s); }
+  void setTextSize(uint8_t sx, uint8_t sy)
+  {
+    textSizeX = sx ? sx : 1;
+    textSizeY = sy ? sy : 1;
+  }
+  void setTextColor(uint16_t) {}
+  void setTextColor(uint16_t, uint16_t) {}
+  void cp437(bool = true) {}
+
+  void setRotation(uint8_t r)
+  {
+    rotation = r & 3;
+    _width = (rotation & 1) ? HEIGHT : WIDTH;
+    _height = (rotation & 1) ? WIDTH : HEIGHT;
+  }
+
+  uint8_t getRotation() const { return rotation; }
+  int16_t width() const { return _width; }
+  int16_t height() const { return _height; }
+
+protected:
+  const int16_t WIDTH;
+  const int16_t HEIGHT;
+  int16_t _width;
+  int16_t _height;
+  int16_t cursorX = 0;
+  int16_t cursorY = 0;
+  uint8_t textSizeX = 1;
+  uint8_t textSizeY = 1;
+  uint8_t rotation = 0;
+};
+
+#endif
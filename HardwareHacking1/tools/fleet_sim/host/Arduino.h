@@ -0,0 +1,111 @@
+// Host stand-in for Arduino.h.  Everything a sketch would reach hardware
+// through lands on the Board the calling worker thread has selected, see
+// ../board.h
+#ifndef FLEET_SIM_ARDUINO_H
+#define FLEET_SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+// Uno A4 / A5
+#define SDA 18
+#define SCL 19
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+
+// Not Arduino: the host's own clock, which unlike the board's virtual one
+// moves while the firmware is working
+unsigned long hostMicros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+// Functions rather than Arduino's macros, so they can't break std headers.
+// They return by value: decltype(a < b ? a : b) would be a reference to a
+// parameter.
+template <typename A, typename B> inline typename std::common_type<A, B>::type min(A a, B b) { return (a < b) ? a : b; }
+template <typename A, typename B> inline typename std::common_type<A, B>::type max(A a, B b) { return (a > b) ? a : b; }
+
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t len);
+  size_t write(const char* str) { return str ? write((const uint8_t*) str, strlen(str)) : 0; }
+  size_t write(const char* buf, size_t len) { return write((const uint8_t*) buf, len); }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const __FlashStringHelper* str) { return write((const char*) str); }
+  size_t print(const char* str) { return write(str); }
+  size_t print(char c) { return write((uint8_t) c); }
+  size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+  size_t print(int n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+  size_t print(long n, int base = DEC) { return printSigned(n, base); }
+  size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T val) { size_t n = print(val); return n + println(); }
+  template <typename T> size_t println(T val, int base) { size_t n = print(val, base); return n + println(); }
+
+private:
+  size_t printSigned(long n, int base);
+  size_t printNumber(unsigned long n, int base);
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud);
+  operator bool() { return true; }
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  int availableForWrite() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+#endif
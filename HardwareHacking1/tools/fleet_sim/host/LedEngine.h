@@ -0,0 +1,19 @@
+// Host stand-in for LedEngine.  There are no LEDs on the host and nothing
+// in the vault reads their state back, so every call does nothing.
+#ifndef FLEET_SIM_LED_ENGINE_H
+#define FLEET_SIM_LED_ENGINE_H
+
+#include <Arduino.h>
+
+inline void ledBegin() {}
+inline void ledAttach(uint8_t, uint8_t) {}
+inline void ledOn(uint8_t) {}
+inline void ledOff(uint8_t) {}
+inline void ledPattern(uint8_t, uint16_t, uint16_t) {}
+inline void ledBlink(uint8_t, uint16_t) {}
+inline void ledPulse(uint8_t, uint16_t, uint16_t) {}
+inline void ledOneShot(uint8_t, uint16_t) {}
+inline void ledGetJitter(uint8_t, int16_t* minUs, int16_t* maxUs) { *minUs = 0; *maxUs = 0; }
+inline void ledResetJitter(uint8_t) {}
+
+#endif
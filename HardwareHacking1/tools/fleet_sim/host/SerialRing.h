@@ -0,0 +1,44 @@
+// Host stand-in for SerialRing.  The board's UART (../board.h) already
+// plays the console, so Console is the host Serial.  The host only ever
+// types whole commands and waits for the answer, so the receive ring
+// never fills and only the byte count and peak are kept.  Diag is the
+// library's own SerialDiag over the board's UART, one per board (its line
+// state and counters are per vault).
+#ifndef FLEET_SIM_SERIAL_RING_H
+#define FLEET_SIM_SERIAL_RING_H
+
+#include <Arduino.h>
+#include <SerialDiag.h>
+
+#define SERIAL_RX_RING_LEN 256
+#define SERIAL_TX_RING_LEN 64
+#define SERIAL_LINE_LOST 0x18
+
+struct SerialRxStats
+{
+  unsigned long bytes;
+  uint16_t dropped;
+  uint16_t linesLost;
+  uint16_t overruns;
+  uint16_t frameErrors;
+  uint8_t peak;
+};
+
+struct SerialTxStats
+{
+  unsigned long bytes;
+  unsigned long stalls;
+};
+
+#define Console Serial
+#define Diag (serialDiag())
+
+// The selected board's
+SerialDiag& serialDiag();
+
+uint8_t serialLines();
+void serialGetStats(struct SerialRxStats* out);
+void serialGetTxStats(struct SerialTxStats* out);
+void serialResetStats();
+
+#endif
@@ -0,0 +1,12 @@
+// Host stand-in for Wire.h.  The RTC is reached through I2cBus, which the
+// fleet simulator implements directly on the Board (board.cpp), so nothing
+// here is ever called.
+#ifndef FLEET_SIM_WIRE_H
+#define FLEET_SIM_WIRE_H
+
+#include <Arduino.h>
+
+// Wire's transmit buffer, the vault sizes its RTC transfers by it
+#define BUFFER_LENGTH 32
+
+#endif
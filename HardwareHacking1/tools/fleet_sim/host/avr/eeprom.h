@@ -0,0 +1,11 @@
+// Host stand-in for avr/eeprom.h.  Addresses index the selected Board's
+// EEPROM, which starts out erased (all 0xff) like a new chip.
+#ifndef FLEET_SIM_EEPROM_H
+#define FLEET_SIM_EEPROM_H
+
+#include <stdint.h>
+
+uint8_t eeprom_read_byte(const uint8_t* addr);
+void eeprom_update_byte(uint8_t* addr, uint8_t val);
+
+#endif
@@ -0,0 +1,12 @@
+// Host stand-in for avr/interrupt.h.  Nothing interrupts a vault on the
+// host, handlers just become ordinary functions nobody calls.
+#ifndef FLEET_SIM_INTERRUPT_H
+#define FLEET_SIM_INTERRUPT_H
+
+#define ISR(vector, ...) void hostIsr_##vector()
+#define EMPTY_INTERRUPT(vector) void hostIsr_##vector() {}
+
+#define cli()
+#define sei()
+
+#endif
@@ -0,0 +1,44 @@
+// Host stand-in for the ATmega328P registers a sketch touches.  The GPIO
+// ports are the selected Board's, so buttons pressed by the fleet show up
+// in FastPin reads; the rest are scratch that nothing reads back.
+#ifndef FLEET_SIM_IO_H
+#define FLEET_SIM_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#define PIND (hostBoardPort(0)->pin)
+#define PORTD (hostBoardPort(0)->port)
+#define DDRD (hostBoardPort(0)->ddr)
+#define PINB (hostBoardPort(1)->pin)
+#define PORTB (hostBoardPort(1)->port)
+#define DDRB (hostBoardPort(1)->ddr)
+#define PINC (hostBoardPort(2)->pin)
+#define PORTC (hostBoardPort(2)->port)
+#define DDRC (hostBoardPort(2)->ddr)
+
+struct HostPort
+{
+  volatile uint8_t pin;
+  volatile uint8_t port;
+  volatile uint8_t ddr;
+};
+
+struct HostPort* hostBoardPort(uint8_t n);
+
+extern thread_local volatile uint8_t MCUSR;
+extern thread_local volatile uint8_t WDTCSR;
+extern thread_local volatile uint8_t PCICR;
+extern thread_local volatile uint8_t PCMSK0;
+extern thread_local volatile uint8_t PCMSK1;
+extern thread_local volatile uint8_t PCMSK2;
+
+#define WDIE 6
+
+// Uno pin change interrupt mapping
+#define digitalPinToPCICRbit(p) ( ((p) <= 7) ? 2 : ( ((p) <= 13) ? 0 : 1 ) )
+#define digitalPinToPCMSK(p) ( ((p) <= 7) ? &PCMSK2 : ( ((p) <= 13) ? &PCMSK0 : &PCMSK1 ) )
+#define digitalPinToPCMSKbit(p) ( ((p) <= 7) ? (p) : ( ((p) <= 13) ? ((p) - 8) : ((p) - 14) ) )
+
+#endif
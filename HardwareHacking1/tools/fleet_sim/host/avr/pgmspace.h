@@ -0,0 +1,22 @@
+// Host stand-in for avr/pgmspace.h: there is only one address space
+#ifndef FLEET_SIM_PGMSPACE_H
+#define FLEET_SIM_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(p) (*(const uint8_t*) (p))
+#define pgm_read_word(p) (*(const uint16_t*) (p))
+#define pgm_read_dword(p) (*(const uint32_t*) (p))
+#define pgm_read_ptr(p) (*(void* const*) (p))
+
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+#endif
@@ -0,0 +1,15 @@
+// Host stand-in for avr/sleep.h.  Sleeping skips the selected Board's
+// clock ahead to the next thing that would have woken it.
+#ifndef FLEET_SIM_SLEEP_H
+#define FLEET_SIM_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+
+void hostSleep();
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() hostSleep()
+
+#endif
@@ -0,0 +1,19 @@
+// Host stand-in for avr/wdt.h.  Nothing ever resets a vault, but the board
+// keeps the longest stretch between feeds, so fleet_sim can report one
+// that would have tripped a real watchdog.
+#ifndef FLEET_SIM_WDT_H
+#define FLEET_SIM_WDT_H
+
+#include <stdint.h>
+
+#define WDTO_15MS 0
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+
+void wdt_enable(uint8_t timeout);
+void wdt_disable();
+void wdt_reset();
+
+#endif
@@ -0,0 +1,17 @@
+// Host stand-in for util/crc16.h, same algorithms as avr-libc's
+#ifndef FLEET_SIM_CRC16_H
+#define FLEET_SIM_CRC16_H
+
+#include <stdint.h>
+
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+  crc = crc ^ ((uint16_t) data << 8);
+  for (int i = 0; i < 8; i++)
+  {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  }
+  return crc;
+}
+
+#endif
@@ -0,0 +1,5 @@
+// Host stand-in for util/twi.h.  Host builds drive the display over SPI,
+// so the raw TWI transport is never compiled.
+#ifndef FLEET_SIM_TWI_H
+#define FLEET_SIM_TWI_H
+#endif
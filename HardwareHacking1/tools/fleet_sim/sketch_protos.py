@@ -0,0 +1,91 @@
+"""
+Turns the vault sketch into a C++ file a host compiler will take, by doing
+what the Arduino builder does before it compiles a sketch: declare every
+function at the top, so calls can come before definitions.
+
+The prototypes go in just before the first function definition (or the
+conditional block around it), the same place arduino-cli puts them.
+
+  python3 sketch_protos.py ../../src_sanitized.c > vault_sketch.cpp
+"""
+
+import argparse
+import re
+import sys
+
+SKIP_WORDS = ("return", "else", "if", "for", "while", "switch", "template", "typedef", "static_assert")
+
+# return type, name, args, optional open brace, on one (joined) line
+DEFINITION = re.compile(r'^([A-Za-z_][\w\s\*&:<>,]*?[\s\*&]+)(\w+)\s*\(([^;{}]*)\)\s*(\{)?\s*$')
+
+
+def find_definitions(lines):
+    """Yields (line index, prototype) for every top level function definition."""
+    i = 0
+    while i < len(lines):
+        line = lines[i]
+        sig = line
+        end = i
+
+        # Signatures split over several lines
+        while sig.count("(") > sig.count(")") and end + 1 < len(lines):
+            end += 1
+            sig += " " + lines[end].strip()
+
+        m = None
+        if line[:1].isalpha() and line.split("(")[0].split()[0] not in SKIP_WORDS:
+            m = DEFINITION.match(sig)
+
+        if m and "operator" not in sig and not (i > 0 and lines[i - 1].startswith("template")):
+            has_body = m.group(4) or (end + 1 < len(lines) and lines[end + 1].strip() == "{")
+            if has_body:
+                ret, name, args = m.group(1), m.group(2), m.group(3)
+                # Default arguments only belong on one declaration
+                args = re.sub(r"=\s*[^,)]+", "", args)
+                static = ret.startswith("static")
+                if name not in ("setup", "loop") and not static:
+                    yield i, ret + name + "(" + args + ");"
+                else:
+                    yield i, None
+
+        i = end + 1
+
+
+def insertion_point(lines, first_def):
+    """Moves the insertion point out of any #if block the first definition is in."""
+    depth = 0
+    block_start = None
+    for k in range(first_def):
+        t = lines[k].strip()
+        if t.startswith("#if"):
+            if depth == 0:
+                block_start = k
+            depth += 1
+        elif t.startswith("#endif"):
+            depth -= 1
+    return block_start if depth > 0 else first_def
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Add Arduino style prototypes to a sketch")
+    parser.add_argument("sketch", help="sketch source (.ino or .c)")
+    args = parser.parse_args()
+
+    lines = open(args.sketch).read().split("\n")
+    defs = list(find_definitions(lines))
+    if not defs:
+        sys.exit("No function definitions found in " + args.sketch)
+
+    first = insertion_point(lines, defs[0][0])
+    protos = [p for _, p in defs if p]
+
+    out = ["#include <Arduino.h>", '#line 1 "%s"' % args.sketch]
+    out += lines[:first]
+    out += protos
+    out += ['#line %d "%s"' % (first + 1, args.sketch)]
+    out += lines[first:]
+    sys.stdout.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
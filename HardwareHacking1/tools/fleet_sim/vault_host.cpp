@@ -0,0 +1,54 @@
+// The vault firmware built for the host.  build.sh generates
+// vault_sketch.cpp from src_sanitized.c (prototypes added, nothing else
+// changed) and this file wraps it with what the fleet needs to create and
+// switch between vaults.
+#include "vault_host.h"
+#include "vault_sketch.cpp"
+
+thread_local struct Vault* gVaultCtx = nullptr;
+
+struct Vault* vaultNew()
+{
+  struct Vault* v = new Vault();
+
+  // The .noinit flight recorder after power on: garbage, no magic.  The
+  // reset cause is what a real power on leaves in MCUSR.
+  memset(&v->flight, 0xa5, sizeof(v->flight));
+  v->resetCause = 1;
+  return v;
+}
+
+void vaultDelete(struct Vault* v)
+{
+  delete v;
+}
+
+void vaultSelect(struct Vault* v)
+{
+  gVaultCtx = v;
+  timerUseQueue(v ? &v->timers : nullptr);
+}
+
+uint8_t vaultMode()
+{
+  return gVault.bgMode;
+}
+
+uint8_t vaultLocked()
+{
+  return gVault.isLocked;
+}
+
+void vaultStats(struct VaultStats* st)
+{
+  st->loopMaxMs = gVault.loopMaxMs;
+  st->sleepMillis = gVault.sleepMillis;
+  st->displayPushCount = gVault.displayPushCount;
+  st->displayPushErrors = gVault.displayPushErrors;
+  st->traceDropped = gVault.traceDropped;
+  st->snakeAuto = gVault.snakeAuto;
+  st->snakeTicks = gVault.snakeTicks;
+  st->snakeTickMaxUs = gVault.snakeTickMaxUs;
+  st->snakeGames = gVault.snakeGames;
+  st->snakeBestScore = max(gVault.snakeBestScore, gVault.snakeScore);
+}
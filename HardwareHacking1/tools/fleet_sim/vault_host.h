@@ -0,0 +1,39 @@
+// Fleet side view of the host built firmware, see vault_host.cpp.  The
+// Vault itself stays opaque out here; a worker selects a vault (and its
+// board) and then calls straight into the firmware.
+#ifndef FLEET_SIM_VAULT_HOST_H
+#define FLEET_SIM_VAULT_HOST_H
+
+#include <stdint.h>
+
+struct Vault;
+
+struct VaultStats
+{
+  unsigned long loopMaxMs;
+  unsigned long sleepMillis;
+  unsigned long displayPushCount;
+  unsigned int displayPushErrors;
+  uint16_t traceDropped;
+  uint8_t snakeAuto;
+  unsigned long snakeTicks;
+  unsigned long snakeTickMaxUs;
+  uint16_t snakeGames;
+  uint16_t snakeBestScore;
+};
+
+struct Vault* vaultNew();
+void vaultDelete(struct Vault* v);
+
+// Every call below, and every firmware function, acts on the selected vault
+void vaultSelect(struct Vault* v);
+
+// The firmware's setup() minus its endless loop, and one pass of that loop
+void vaultBoot();
+void vaultPass();
+
+uint8_t vaultMode();
+uint8_t vaultLocked();
+void vaultStats(struct VaultStats* st);
+
+#endif
@@ -0,0 +1,25 @@
+// Host stand-in for the bits of Arduino.h the I2C layer uses, backed by the
+// emulated bus and clock in i2c_emu.cpp
+#ifndef I2C_EMU_ARDUINO_H
+#define I2C_EMU_ARDUINO_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+// Uno A4 / A5
+#define SDA 18
+#define SCL 19
+
+unsigned long micros();
+unsigned long millis();
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+
+#endif
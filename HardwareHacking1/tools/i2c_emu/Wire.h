@@ -0,0 +1,40 @@
+// Host stand-in for the AVR core's TwoWire, talking to the emulated devices
+// in i2c_emu.cpp instead of the TWI peripheral
+#ifndef I2C_EMU_WIRE_H
+#define I2C_EMU_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+class TwoWire
+{
+public:
+  void begin();
+  void end();
+  void setClock(uint32_t hz);
+  void setWireTimeout(uint32_t us, bool resetOnTimeout);
+  bool getWireTimeoutFlag();
+  void clearWireTimeoutFlag();
+
+  void beginTransmission(uint8_t addr);
+  size_t write(uint8_t val);
+  size_t write(const uint8_t* buf, size_t len);
+  uint8_t endTransmission(bool sendStop = true);
+
+  uint8_t requestFrom(uint8_t addr, uint8_t len);
+  int available();
+  int read();
+
+private:
+  uint8_t txAddr;
+  uint8_t txBuf[BUFFER_LENGTH];
+  uint8_t txLen;
+  uint8_t rxBuf[BUFFER_LENGTH];
+  uint8_t rxLen;
+  uint8_t rxPos;
+};
+
+extern TwoWire Wire;
+
+#endif
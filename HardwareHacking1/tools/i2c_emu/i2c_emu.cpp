@@ -0,0 +1,570 @@
+/**************************************************************************
+ I2C bus emulator
+
+ Runs the firmware's I2C layer (libraries/I2cBus) on the host against an
+ emulated bus with a DS1307 and an SSD1306 on it, and injects the faults
+ that are hard to produce on a real board: address / data NAKs, short
+ reads, and a device holding SDA low (released after some number of
+ recovery clocks, or never).  Time is simulated, so each scenario also
+ checks the call's worst case latency against its bound.
+
+ Build (from this directory):
+   g++ -std=c++17 -O2 -I. -I../../../libraries/I2cBus -o i2c_emu \
+     i2c_emu.cpp ../../../libraries/I2cBus/I2cBus.cpp
+
+ Run every scenario, exits non-zero if any fail:
+   ./i2c_emu
+   ./i2c_emu -v      also log every bus transaction
+ **************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "I2cBus.h"
+
+#define RTC_ADDR 0x68
+#define OLED_ADDR 0x3c
+#define ABSENT_ADDR 0x50
+
+static bool gVerbose = false;
+
+// --- Simulated time ------------------------------------------------------
+
+static unsigned long gNowUs = 0;
+
+unsigned long micros()
+{
+  return gNowUs;
+}
+
+unsigned long millis()
+{
+  return gNowUs / 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  gNowUs += us;
+}
+
+// --- Faults --------------------------------------------------------------
+
+#define FOREVER 255
+
+struct Faults
+{
+  uint8_t nakAddr = 0;        // next N transactions NAK the address
+  uint8_t nakData = 0;        // next N writes NAK the first data byte
+  uint8_t shortRead = 0;      // next N reads return one byte short
+  bool stuck = false;         // a device is holding SDA low
+  uint8_t releaseClocks = 0;  // SCL clocks before it lets go, FOREVER = never
+};
+
+static Faults gFaults;
+
+static void consume(uint8_t& count)
+{
+  if ( (count != 0) && (count != FOREVER) )
+  {
+    count--;
+  }
+}
+
+// --- Pins, for bus recovery ----------------------------------------------
+
+static uint8_t gSclMode = INPUT;
+static unsigned gRecoveryClocks = 0;
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if (pin == SCL)
+  {
+    if ( (gSclMode == OUTPUT) && (mode != OUTPUT) )
+    {
+      // SCL released after being pulled low: one clock
+      gRecoveryClocks++;
+      if (gFaults.stuck && (gFaults.releaseClocks != FOREVER))
+      {
+        if (--gFaults.releaseClocks == 0)
+        {
+          gFaults.stuck = false;
+        }
+      }
+    }
+    gSclMode = mode;
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (pin == SDA)
+  {
+    return gFaults.stuck ? LOW : HIGH;
+  }
+  if (pin == SCL)
+  {
+    return (gSclMode == OUTPUT) ? LOW : HIGH;
+  }
+  return HIGH;
+}
+
+// --- Devices -------------------------------------------------------------
+
+struct Ds1307
+{
+  uint8_t regs[64];
+  uint8_t ptr = 0;
+
+  void write(const uint8_t* buf, uint8_t len)
+  {
+    ptr = buf[0] & 0x3f;
+    for(uint8_t i = 1; i < len; i++)
+    {
+      regs[ptr] = buf[i];
+      ptr = (ptr + 1) & 0x3f;
+    }
+  }
+
+  uint8_t read()
+  {
+    uint8_t val = regs[ptr];
+    ptr = (ptr + 1) & 0x3f;
+    return val;
+  }
+};
+
+struct Ssd1306
+{
+  unsigned commands = 0;
+  unsigned dataBytes = 0;
+
+  void write(const uint8_t* buf, uint8_t len)
+  {
+    // First byte is the control byte: 0x00 commands, 0x40 display data
+    if (buf[0] & 0x40)
+    {
+      dataBytes += len - 1;
+    }
+    else
+    {
+      commands += len - 1;
+    }
+  }
+};
+
+static Ds1307 gRtc;
+static Ssd1306 gOled;
+
+// --- Wire ----------------------------------------------------------------
+
+TwoWire Wire;
+
+static uint32_t gClockHz = 100000;
+static uint32_t gTimeoutUs = 0;
+static bool gTimeoutFlag = false;
+static unsigned gTransactions = 0;
+
+static void busTime(unsigned bytes)
+{
+  // Start + address, the bytes, stop; 9 clocks a byte
+  gNowUs += ( (bytes + 1) * 9 + 2 ) * 1000000UL / gClockHz;
+}
+
+// With SDA held low the TWI can't get a START out, Wire's timeout catches it
+static bool busStuck()
+{
+  if (!gFaults.stuck)
+  {
+    return false;
+  }
+
+  gNowUs += gTimeoutUs;
+  gTimeoutFlag = true;
+  return true;
+}
+
+static bool present(uint8_t addr)
+{
+  return (addr == RTC_ADDR) || (addr == OLED_ADDR);
+}
+
+void TwoWire::begin()
+{
+  txLen = 0;
+  rxLen = 0;
+  rxPos = 0;
+  gClockHz = 100000;
+}
+
+void TwoWire::end()
+{
+}
+
+void TwoWire::setClock(uint32_t hz)
+{
+  gClockHz = hz;
+}
+
+void TwoWire::setWireTimeout(uint32_t us, bool)
+{
+  gTimeoutUs = us;
+}
+
+bool TwoWire::getWireTimeoutFlag()
+{
+  return gTimeoutFlag;
+}
+
+void TwoWire::clearWireTimeoutFlag()
+{
+  gTimeoutFlag = false;
+}
+
+void TwoWire::beginTransmission(uint8_t addr)
+{
+  txAddr = addr;
+  txLen = 0;
+}
+
+size_t TwoWire::write(uint8_t val)
+{
+  if (txLen >= BUFFER_LENGTH)
+  {
+    return 0;
+  }
+  txBuf[txLen++] = val;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t* buf, size_t len)
+{
+  size_t n = 0;
+  while ( (n < len) && write(buf[n]) )
+  {
+    n++;
+  }
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(bool)
+{
+  gTransactions++;
+  if (busStuck())
+  {
+    return I2C_TIMEOUT;
+  }
+
+  if (!present(txAddr) || gFaults.nakAddr)
+  {
+    consume(gFaults.nakAddr);
+    busTime(0);
+    return I2C_NAK_ADDR;
+  }
+
+  if (gFaults.nakData && (txLen > 1))
+  {
+    consume(gFaults.nakData);
+    busTime(1);
+    return I2C_NAK_DATA;
+  }
+
+  busTime(txLen);
+  if (txAddr == RTC_ADDR)
+  {
+    gRtc.write(txBuf, txLen);
+  }
+  else
+  {
+    gOled.write(txBuf, txLen);
+  }
+
+  if (gVerbose)
+  {
+    printf("    w %02x, %u bytes\n", txAddr, txLen);
+  }
+  return I2C_OK;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t addr, uint8_t len)
+{
+  gTransactions++;
+  rxLen = 0;
+  rxPos = 0;
+
+  if (busStuck())
+  {
+    return 0;
+  }
+
+  // The SSD1306 can't be read over I2C at all
+  if ( (addr != RTC_ADDR) || gFaults.nakAddr )
+  {
+    consume(gFaults.nakAddr);
+    busTime(0);
+    return 0;
+  }
+
+  if (len > BUFFER_LENGTH)
+  {
+    len = BUFFER_LENGTH;
+  }
+  if (gFaults.shortRead && (len > 0))
+  {
+    consume(gFaults.shortRead);
+    len--;
+  }
+
+  for(uint8_t i = 0; i < len; i++)
+  {
+    rxBuf[rxLen++] = gRtc.read();
+  }
+  busTime(len);
+
+  if (gVerbose)
+  {
+    printf("    r %02x, %u bytes\n", addr, len);
+  }
+  return len;
+}
+
+int TwoWire::available()
+{
+  return rxLen - rxPos;
+}
+
+int TwoWire::read()
+{
+  return (rxPos < rxLen) ? rxBuf[rxPos++] : -1;
+}
+
+// --- Scenarios -----------------------------------------------------------
+
+// Slowest a call can possibly be: every try times out twice (address phase
+// and read phase), is followed by a recovery, then the backoff
+static unsigned long worstCaseUs()
+{
+  unsigned long recoveryUs = (9 * 2 + 4) * 5;
+  unsigned long us = 0;
+  unsigned long backoff = I2C_BACKOFF_US;
+  for(int i = 0; i < I2C_MAX_TRIES; i++)
+  {
+    us += 2 * I2C_TIMEOUT_US + recoveryUs + 1000;
+    if (i + 1 < I2C_MAX_TRIES)
+    {
+      us += backoff;
+      backoff <<= 1;
+    }
+  }
+  return us;
+}
+
+struct Result
+{
+  std::string name;
+  bool pass;
+  std::string why;
+};
+
+static std::vector<Result> gResults;
+
+static void reset()
+{
+  gFaults = Faults();
+  gTimeoutFlag = false;
+  gRecoveryClocks = 0;
+  gTransactions = 0;
+  for(int i = 0; i < 64; i++)
+  {
+    gRtc.regs[i] = i * 3;
+  }
+  gOled = Ssd1306();
+  i2cBegin();
+  i2cResetStats();
+}
+
+static void check(const char* name, bool ok, const char* why)
+{
+  const I2cStats* st = i2cGetStats();
+  printf("%-34s %s  max %6lu us, %u retries, %u recoveries, %u clocks\n",
+         name, ok ? "PASS" : "FAIL", st->maxUs, st->retries, st->recoveries,
+         gRecoveryClocks);
+  if (!ok)
+  {
+    printf("    %s\n", why);
+  }
+  gResults.push_back({name, ok, why});
+}
+
+static bool bounded()
+{
+  return i2cGetStats()->maxUs <= worstCaseUs();
+}
+
+static void scenarioClean()
+{
+  reset();
+  uint8_t out[4] = { 0xde, 0xad, 0xbe, 0xef };
+  uint8_t in[4];
+  bool ok = (i2cWrite(RTC_ADDR, 0x08, out, 4) == I2C_OK) &&
+            (i2cRead(RTC_ADDR, 0x08, in, 4) == I2C_OK) &&
+            (memcmp(in, out, 4) == 0) &&
+            (i2cGetStats()->retries == 0);
+  check("clean write + read back", ok, "data mismatch or unexpected retry");
+}
+
+static void scenarioNakOnce()
+{
+  reset();
+  gFaults.nakAddr = 1;
+  uint8_t in[3];
+  bool ok = (i2cRead(RTC_ADDR, 0, in, 3) == I2C_OK) &&
+            (i2cGetStats()->retries == 1) && (in[1] == 3);
+  check("address NAK once", ok, "expected success after one retry");
+}
+
+static void scenarioAbsent()
+{
+  reset();
+  uint8_t in[1];
+  bool ok = (i2cRead(ABSENT_ADDR, 0, in, 1) == I2C_NAK_ADDR) &&
+            (i2cGetStats()->retries == I2C_MAX_TRIES - 1) &&
+            (i2cGetStats()->failures == 1) && bounded();
+  check("absent device", ok, "expected NAK after every try, within the bound");
+}
+
+static void scenarioDataNak()
+{
+  reset();
+  gFaults.nakData = 1;
+  uint8_t val = 0x44;
+  uint8_t in;
+  bool ok = (i2cWrite(RTC_ADDR, 0x00, &val, 1) == I2C_OK) &&
+            (i2cRead(RTC_ADDR, 0x00, &in, 1) == I2C_OK) && (in == 0x44);
+  check("data NAK once on write", ok, "expected the retry to land the write");
+}
+
+static void scenarioShortOnce()
+{
+  reset();
+  gFaults.shortRead = 1;
+  uint8_t in[8];
+  bool ok = (i2cRead(RTC_ADDR, 0x10, in, 8) == I2C_OK) && (in[7] == 0x17 * 3);
+  check("short read once", ok, "expected a full read on retry");
+}
+
+static void scenarioShortAlways()
+{
+  reset();
+  gFaults.shortRead = FOREVER;
+  uint8_t in[8];
+  bool ok = (i2cRead(RTC_ADDR, 0x10, in, 8) == I2C_SHORT_READ) &&
+            (i2cGetStats()->failures == 1) && bounded();
+  check("short read every time", ok, "expected I2C_SHORT_READ within the bound");
+}
+
+static void scenarioStuckReleases()
+{
+  reset();
+  gFaults.stuck = true;
+  gFaults.releaseClocks = 5;
+  uint8_t in[3];
+  bool ok = (i2cRead(RTC_ADDR, 0, in, 3) == I2C_OK) &&
+            (i2cGetStats()->recoveries == 1) && (gRecoveryClocks == 5) && bounded();
+  check("SDA stuck, freed by 5 clocks", ok, "expected one recovery then success");
+}
+
+static void scenarioStuckNine()
+{
+  reset();
+  gFaults.stuck = true;
+  gFaults.releaseClocks = 9;
+  uint8_t val = 1;
+  bool ok = (i2cWrite(RTC_ADDR, 0x3f, &val, 1) == I2C_OK) &&
+            (i2cGetStats()->recoveries == 1) && bounded();
+  check("SDA stuck, freed by 9th clock", ok, "nine clocks should always be enough");
+}
+
+static void scenarioStuckForever()
+{
+  reset();
+  gFaults.stuck = true;
+  gFaults.releaseClocks = FOREVER;
+  uint8_t in[3];
+  uint8_t status = i2cRead(RTC_ADDR, 0, in, 3);
+  bool ok = (status == I2C_TIMEOUT) &&
+            (i2cGetStats()->recoveries == I2C_MAX_TRIES) && bounded();
+  check("SDA shorted low", ok, "expected a timeout, a recovery per try, no hang");
+
+  // Once the short is gone the next call works without any help
+  gFaults.stuck = false;
+  i2cResetStats();
+  ok = (i2cRead(RTC_ADDR, 0, in, 3) == I2C_OK) && (i2cGetStats()->retries == 0);
+  check("  ...then the short clears", ok, "bus should be usable again");
+}
+
+static void scenarioOled()
+{
+  reset();
+  const uint8_t init[] = { 0xae, 0xd5, 0x80, 0xa8, 0x3f };
+  uint8_t page[16];
+  memset(page, 0x55, sizeof(page));
+  bool ok = (i2cWrite(OLED_ADDR, 0x00, init, sizeof(init)) == I2C_OK) &&
+            (i2cWrite(OLED_ADDR, 0x40, page, sizeof(page)) == I2C_OK) &&
+            (gOled.commands == sizeof(init)) && (gOled.dataBytes == sizeof(page));
+  uint8_t in;
+  ok = ok && (i2cRead(OLED_ADDR, 0, &in, 1) != I2C_OK);
+  check("SSD1306 commands + data", ok, "write counts wrong or a read succeeded");
+}
+
+static void scenarioTooLong()
+{
+  reset();
+  uint8_t big[BUFFER_LENGTH];
+  memset(big, 0, sizeof(big));
+  bool ok = (i2cWrite(RTC_ADDR, 0x08, big, sizeof(big)) == I2C_TOO_LONG) &&
+            (i2cGetStats()->retries == 0) && (gTransactions == 1);
+  check("write longer than Wire's buffer", ok, "should fail once, not retry");
+}
+
+int main(int argc, char** argv)
+{
+  for(int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-v") == 0)
+    {
+      gVerbose = true;
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  printf("timeout %u us, %u tries, worst case bound %lu us\n\n",
+         (unsigned) I2C_TIMEOUT_US, (unsigned) I2C_MAX_TRIES, worstCaseUs());
+
+  scenarioClean();
+  scenarioNakOnce();
+  scenarioAbsent();
+  scenarioDataNak();
+  scenarioShortOnce();
+  scenarioShortAlways();
+  scenarioStuckReleases();
+  scenarioStuckNine();
+  scenarioStuckForever();
+  scenarioOled();
+  scenarioTooLong();
+
+  int failed = 0;
+  for(const Result& r : gResults)
+  {
+    failed += r.pass ? 0 : 1;
+  }
+  printf("\n%zu scenarios, %d failed\n", gResults.size(), failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+"""
+Turns the vault firmware's "prof dump" output (built with PROFILER) into a
+table of where the time went, by function.
+
+The board only knows flash addresses, in PROF_BUCKETS (128) buckets
+spread over the whole image: each is the power of two at or above
+_etext / 128 bytes wide, 256 bytes for a typical 20-30 KB build (the
+dump's "Prof bucket" line gives it).  A bucket that wide usually holds
+several functions, so its samples are shared out between them in
+proportion to how many of its bytes each one covers.  That sharing is an
+estimate: a short hot loop and the cold code beside it get the same rate.
+Use the ELF from the same build that made the dump, or the names will be
+wrong.
+
+  python3 prof_symbolize.py capture.txt
+  python3 prof_symbolize.py capture.txt --elf ../build/out/vault.ino.elf
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+DEFAULT_ELF = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "build", "out", "vault.ino.elf")
+
+
+def load_symbols(elf_path, nm):
+    # avr-nm -S prints: address size type name
+    out = subprocess.run([nm, "-n", "-S", "-C", elf_path], check=True,
+                         capture_output=True, text=True).stdout
+
+    syms = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4 or parts[2] not in "tTwW":
+            continue
+        start, size = int(parts[0], 16), int(parts[1], 16)
+        if size:
+            syms.append((start, start + size, parts[3]))
+
+    return syms
+
+
+def load_dump(stream):
+    header = {}
+    buckets = []
+    for line in stream:
+        m = re.match(r"Prof (samples|hz|bucket|other) (\d+)", line)
+        if m:
+            header[m.group(1)] = int(m.group(2))
+            continue
+        m = re.match(r"Prof ([0-9a-fA-F]{4}) (\d+)", line)
+        if m:
+            buckets.append((int(m.group(1), 16), int(m.group(2))))
+
+    return header, buckets
+
+
+def attribute(buckets, width, syms):
+    totals = {}
+    for start, count in buckets:
+        end = start + width
+        covered = []
+        for sym_start, sym_end, name in syms:
+            if sym_end <= start:
+                continue
+            if sym_start >= end:
+                break
+            covered.append((min(end, sym_end) - max(start, sym_start), name))
+
+        # Whatever no symbol covers is padding, vectors or library code
+        # nm has no size for
+        spare = width - sum(n for n, _ in covered)
+        if spare > 0:
+            covered.append((spare, "?? %04x" % start))
+
+        for n, name in covered:
+            totals[name] = totals.get(name, 0.0) + count * n / width
+
+    return totals
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Symbolize a vault firmware profiler dump")
+    parser.add_argument("capture", nargs="?", help="serial output with a prof dump (default stdin)")
+    parser.add_argument("--elf", default=DEFAULT_ELF, help="firmware ELF the dump came from")
+    parser.add_argument("--nm", default="avr-nm", help="nm for the firmware's toolchain")
+    parser.add_argument("--top", type=int, default=25, help="functions to show")
+    args = parser.parse_args()
+
+    stream = open(args.capture) if args.capture else sys.stdin
+    header, buckets = load_dump(stream)
+    if "bucket" not in header:
+        sys.exit("No prof dump found, expected the output of \"prof dump\"")
+
+    syms = load_symbols(args.elf, args.nm)
+    totals = attribute(buckets, header["bucket"], syms)
+
+    samples = header.get("samples", 0)
+    hz = header.get("hz", 0)
+    other = header.get("other", 0)
+    if hz:
+        print("%d samples, %.1f s at %d Hz, %d byte buckets" % (samples, samples / float(hz), hz, header["bucket"]))
+    if other:
+        print("%d samples outside the code (bootloader?)" % other)
+
+    if not samples:
+        return
+
+    print("%7s %8s  %s" % ("%", "samples", "function"))
+    ranked = sorted(totals.items(), key=lambda kv: kv[1], reverse=True)
+    for name, count in ranked[:args.top]:
+        print("%6.1f%% %8.1f  %s" % (100.0 * count / samples, count, name))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Flash and RAM usage of a vault firmware build, and the symbols using the
+# most of each.  Builds the firmware first unless an ELF is given.
+#   tools/size_report.sh [firmware.elf]
+#   tools/size_report.sh -- -DDEBUG_MODE
+
+set -e
+
+if [ -n "$1" ] && [ "$1" != "--" ]; then
+  ELF=$1
+else
+  [ "$1" == "--" ] && shift
+  ELF=$("$(dirname "$0")/build_firmware.sh" "$@")
+fi
+
+TOP=${TOP:-15}
+
+avr-size -C --mcu=atmega328p "$ELF"
+
+# avr-nm -S prints: address size type name
+echo "Largest flash symbols (code and PROGMEM):"
+avr-nm --size-sort -r -C -S "$ELF" | awk '$3 ~ /^[tTwW]$/ { printf "  %6d  %s\n", strtonum("0x" $2), $4 }' | head -n "$TOP"
+
+echo "Largest RAM symbols (data and bss):"
+avr-nm --size-sort -r -C -S "$ELF" | awk '$3 ~ /^[dDbB]$/ { printf "  %6d  %s\n", strtonum("0x" $2), $4 }' | head -n "$TOP"
@@ -0,0 +1,112 @@
+"""
+Decodes the vault firmware's binary trace frames (built with TRACE_BINARY)
+back into the original messages.  Everything that isn't a trace frame is
+passed through untouched, so normal shell output still shows up.
+
+The event list is read straight out of the firmware source, so the ids
+always line up with whatever build is on the board.
+
+  cat /dev/ttyACM0 | python3 trace_decode.py
+  python3 trace_decode.py capture.bin --src ../src_sanitized.c
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+TRACE_SYNC = 0xa5
+RECORD = struct.Struct("<BHhh")
+
+DEFAULT_SRC = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src_sanitized.c")
+
+
+def load_events(src_path):
+    src = open(src_path).read()
+
+    events = []
+    for m in re.finditer(r'X\((\w+),\s*(\w+),\s*(\w+),\s*"([^"]*)"\)', src):
+        events.append((m.group(1), m.group(2), m.group(3), m.group(4)))
+
+    modes = {}
+    for m in re.finditer(r'X\((\d+),\s*"([^"]*)",', src):
+        modes[int(m.group(1))] = m.group(2)
+
+    return events, modes
+
+
+def format_arg(kind, val, modes):
+    if kind == "TRACE_ARG_DEC":
+        return " %d" % val
+    if kind == "TRACE_ARG_HEX":
+        return " %02x" % (val & 0xff)
+    if kind == "TRACE_ARG_MODE":
+        return " " + modes.get(val, "snake")
+    if kind == "TRACE_ARG_CMD":
+        # CMD_LIST indices depend on the build flags
+        return " cmd#%d" % val
+    if kind == "TRACE_ARG_ADDR":
+        return " %04x" % (val & 0xffff)
+    return ""
+
+
+def decode(stream, events, modes, out):
+    data = bytearray()
+    last_ms = None
+    time_base = 0
+
+    while True:
+        chunk = stream.read1(256)
+        if not chunk:
+            break
+        data += chunk
+
+        pos = 0
+        while pos < len(data):
+            b = data[pos]
+            if b == TRACE_SYNC:
+                if pos + 1 + RECORD.size > len(data):
+                    # Frame is split across reads, wait for the rest
+                    break
+
+                event_id, time_ms, arg_a, arg_b = RECORD.unpack_from(data, pos + 1)
+                if event_id < len(events):
+                    # Firmware only sends the low 16 bits of millis()
+                    if last_ms is not None and time_ms < last_ms:
+                        time_base += 0x10000
+                    last_ms = time_ms
+
+                    name, kind_a, kind_b, msg = events[event_id]
+                    out.write("[%10.3f] %s%s%s\n" % ((time_base + time_ms) / 1000.0, msg,
+                                                     format_arg(kind_a, arg_a, modes),
+                                                     format_arg(kind_b, arg_b, modes)))
+                    pos += 1 + RECORD.size
+                    continue
+
+            out.write(chr(b))
+            pos += 1
+
+        del data[:pos]
+        out.flush()
+
+    for b in data:
+        out.write(chr(b))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode vault firmware binary traces")
+    parser.add_argument("capture", nargs="?", help="raw serial capture (default stdin)")
+    parser.add_argument("--src", default=DEFAULT_SRC, help="firmware source with the TRACE_EVENTS list")
+    args = parser.parse_args()
+
+    events, modes = load_events(args.src)
+    if not events:
+        sys.exit("No TRACE_EVENTS found in " + args.src)
+
+    stream = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+    decode(stream, events, modes, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,658 @@
+/**************************************************************************
+ Vault fleet provisioning
+
+ Writes the flags, pin codes and challenge mode to every vault board it can
+ find, one worker thread per serial port, then reads everything back to make
+ sure it stuck.  Boards have to be running a DEBUG_MODE build, since that is
+ the only build with wrflgs / wrpins / setchl / getflg / getpns.
+
+ Build:
+   g++ -std=c++17 -O2 -pthread -o vault_provision vault_provision.cpp
+
+ Provision every /dev/ttyACM* and /dev/ttyUSB* board:
+   ./vault_provision --flags fl4g0,fl4g1,fl4g2 --pins 1234,2345,3456,4567 --mode 0
+
+ Try it without hardware against pty-backed fake boards (--fake-bad makes
+ the last N of them corrupt a flag so the verify step has something to catch):
+   ./vault_provision --fake 16 --fake-bad 2 --flags a,b,c --pins 1111,2222,3333,4444
+
+ --ports takes any tty, so it also works against a natively built firmware
+ that exposes its serial port as a pty.
+ **************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define FLAG_MAX_CHARS 11   // a 12th char would leave no null terminator in the RTC RAM
+#define NUM_FLAGS 3
+#define NUM_PINS 4
+#define BOARD_BAUD B9600
+
+typedef std::chrono::steady_clock Clock;
+
+struct ProvisionSpec
+{
+  std::string flags[NUM_FLAGS];
+  unsigned long pins[NUM_PINS];
+  int mode;
+};
+
+struct Options
+{
+  int bootWaitMs = 2500;      // opening the port resets an Uno
+  int replyTimeoutMs = 5000;
+};
+
+struct BoardResult
+{
+  std::string port;
+  bool ok = false;
+  std::string error;
+  size_t bytesTx = 0;
+  size_t bytesRx = 0;
+  double seconds = 0;
+};
+
+/**
+ * Raw 9600 8N1 serial port with an expect-style reader
+ */
+class SerialPort
+{
+public:
+  explicit SerialPort(std::string const & path) : mPath(path) {}
+  ~SerialPort() { if (mFd >= 0) close(mFd); }
+
+  bool open()
+  {
+    mFd = ::open(mPath.c_str(), O_RDWR | O_NOCTTY);
+    if (mFd < 0)
+    {
+      return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(mFd, &tio) == 0)
+    {
+      cfmakeraw(&tio);
+      cfsetispeed(&tio, BOARD_BAUD);
+      cfsetospeed(&tio, BOARD_BAUD);
+      tio.c_cflag |= CLOCAL | CREAD;
+      tcsetattr(mFd, TCSANOW, &tio);
+    }
+    return true;
+  }
+
+  // Throws input away until the line goes quiet for quietMs, but for no
+  // longer than twice that: a board in challenge 0 dumps every RTC read
+  // and is never quiet
+  void drain(int quietMs)
+  {
+    auto deadline = Clock::now() + std::chrono::milliseconds(2 * quietMs);
+    char buf[256];
+    while (Clock::now() < deadline && waitReadable(quietMs))
+    {
+      ssize_t n = read(mFd, buf, sizeof(buf));
+      if (n <= 0)
+      {
+        break;
+      }
+      bytesRx += n;
+    }
+    mRx.clear();
+  }
+
+  bool send(std::string const & str)
+  {
+    size_t pos = 0;
+    while (pos < str.size())
+    {
+      ssize_t n = write(mFd, str.data() + pos, str.size() - pos);
+      if (n <= 0)
+      {
+        return false;
+      }
+      pos += n;
+    }
+    bytesTx += str.size();
+    return true;
+  }
+
+  // Reads until one of the needles shows up.  Returns the index of the
+  // needle found (-1 on timeout), everything up to and including it goes
+  // into text and is consumed.
+  int expect(std::vector<std::string> const & needles, int timeoutMs, std::string* text = nullptr)
+  {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true)
+    {
+      size_t bestPos = std::string::npos;
+      int bestIdx = -1;
+      for (size_t i = 0; i < needles.size(); i++)
+      {
+        size_t p = mRx.find(needles[i]);
+        if (p != std::string::npos && p < bestPos)
+        {
+          bestPos = p;
+          bestIdx = (int) i;
+        }
+      }
+
+      if (bestIdx >= 0)
+      {
+        size_t end = bestPos + needles[bestIdx].size();
+        if (text)
+        {
+          *text = mRx.substr(0, end);
+        }
+        mRx.erase(0, end);
+        return bestIdx;
+      }
+
+      int leftMs = (int) std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+      if (leftMs <= 0 || !waitReadable(leftMs))
+      {
+        return -1;
+      }
+
+      char buf[256];
+      ssize_t n = read(mFd, buf, sizeof(buf));
+      if (n <= 0)
+      {
+        return -1;
+      }
+      mRx.append(buf, n);
+      bytesRx += n;
+    }
+  }
+
+  size_t bytesTx = 0;
+  size_t bytesRx = 0;
+
+private:
+  bool waitReadable(int timeoutMs)
+  {
+    struct pollfd pfd = { mFd, POLLIN, 0 };
+    return poll(&pfd, 1, timeoutMs) > 0;
+  }
+
+  std::string mPath;
+  int mFd = -1;
+  std::string mRx;
+};
+
+static std::string describeTimeout(char const * waitingFor)
+{
+  return std::string("timed out waiting for ") + waitingFor;
+}
+
+static std::string provisionSteps(SerialPort & sp, ProvisionSpec const & spec, Options const & opts)
+{
+  int const t = opts.replyTimeoutMs;
+
+  // Flags
+  sp.send("wrflgs\n");
+  for (int i = 0; i < NUM_FLAGS; i++)
+  {
+    if (sp.expect({"Give me a flag"}, t) < 0)
+      return describeTimeout("flag prompt");
+    sp.send(spec.flags[i] + "\n");
+    if (sp.expect({"Done"}, t) < 0)
+      return describeTimeout("flag write");
+  }
+
+  // Pins
+  sp.send("wrpins\n");
+  for (int i = 0; i < NUM_PINS; i++)
+  {
+    if (sp.expect({"Give me a pin"}, t) < 0)
+      return describeTimeout("pin prompt");
+    sp.send(std::to_string(spec.pins[i]) + "\n");
+    int r = sp.expect({"to external RAM", "nvalid", "Error"}, t);
+    if (r < 0)
+      return describeTimeout("pin write");
+    if (r > 0)
+      return "board rejected pin " + std::to_string(i);
+  }
+
+  // Challenge mode
+  sp.send("setchl\n");
+  if (sp.expect({"challenge mode (0-3)"}, t) < 0)
+    return describeTimeout("setchl prompt (is this a DEBUG_MODE build?)");
+  sp.send(std::to_string(spec.mode) + "\n");
+  if (sp.expect({"Challenge mode set to", "Invalid"}, t) != 0)
+    return "board rejected challenge mode";
+
+  // Read it all back
+  std::string text;
+  sp.send("getflg\n");
+  if (sp.expect({"Flag 3:"}, t, &text) < 0)
+    return describeTimeout("getflg output");
+
+  std::regex flagRe("Flag (\\d): wildcat\\{([^}]*)\\}");
+  int flagsSeen = 0;
+  for (std::sregex_iterator it(text.begin(), text.end(), flagRe), end; it != end; ++it)
+  {
+    int idx = std::stoi((*it)[1]);
+    if ((*it)[2] != spec.flags[idx])
+      return "flag " + std::to_string(idx) + " reads back as '" + (*it)[2].str() + "'";
+    flagsSeen++;
+  }
+  if (flagsSeen != NUM_FLAGS)
+    return "only " + std::to_string(flagsSeen) + " flags read back";
+
+  sp.send("getpns\n");
+  std::string lastLine;
+  if (sp.expect({"Pin 3: "}, t, &text) < 0 || sp.expect({"\n"}, t, &lastLine) < 0)
+    return describeTimeout("getpns output");
+  text += lastLine;
+
+  std::regex pinRe("Pin (\\d): (\\d+)");
+  int pinsSeen = 0;
+  for (std::sregex_iterator it(text.begin(), text.end(), pinRe), end; it != end; ++it)
+  {
+    // The board only keeps the low 16 bits when it reads a pin back
+    int idx = std::stoi((*it)[1]);
+    unsigned long got = std::stoul((*it)[2]);
+    if (got != (spec.pins[idx] & 0xffff))
+      return "pin " + std::to_string(idx) + " reads back as " + std::to_string(got);
+    pinsSeen++;
+  }
+  if (pinsSeen != NUM_PINS)
+    return "only " + std::to_string(pinsSeen) + " pins read back";
+
+  sp.send("ver\n");
+  if (sp.expect({"DEBUG! "}, t) < 0 || sp.expect({"\n"}, t, &text) < 0)
+    return describeTimeout("ver output");
+  if (std::atoi(text.c_str()) != spec.mode)
+    return "challenge mode reads back as " + std::to_string(std::atoi(text.c_str()));
+
+  return "";
+}
+
+static BoardResult provisionBoard(std::string const & port, ProvisionSpec const & spec, Options const & opts)
+{
+  BoardResult res;
+  res.port = port;
+  auto start = Clock::now();
+
+  SerialPort sp(port);
+  if (!sp.open())
+  {
+    res.error = std::string("open failed: ") + strerror(errno);
+    return res;
+  }
+
+  sp.drain(opts.bootWaitMs);
+
+  res.error = provisionSteps(sp, spec, opts);
+  res.ok = res.error.empty();
+  res.bytesTx = sp.bytesTx;
+  res.bytesRx = sp.bytesRx;
+  res.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return res;
+}
+
+/**
+ * Fake board on a pty that speaks just enough of the DEBUG_MODE shell for
+ * provisioning, paced like a 9600 baud link
+ */
+class FakeBoard
+{
+public:
+  FakeBoard(bool corruptFlag) : mCorrupt(corruptFlag) {}
+
+  ~FakeBoard()
+  {
+    mStop = true;
+    if (mThread.joinable())
+      mThread.join();
+    if (mSlave >= 0)
+      close(mSlave);
+    if (mMaster >= 0)
+      close(mMaster);
+  }
+
+  bool start()
+  {
+    mMaster = posix_openpt(O_RDWR | O_NOCTTY);
+    if (mMaster < 0 || grantpt(mMaster) != 0 || unlockpt(mMaster) != 0)
+      return false;
+
+    mSlavePath = ptsname(mMaster);
+
+    // Hold the slave open and raw so the line discipline never echoes or
+    // cooks anything, and the master doesn't see EIO between clients
+    mSlave = ::open(mSlavePath.c_str(), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    tcgetattr(mSlave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(mSlave, TCSANOW, &tio);
+
+    mThread = std::thread(&FakeBoard::run, this);
+    return true;
+  }
+
+  std::string const & path() const { return mSlavePath; }
+
+private:
+  void say(std::string const & str)
+  {
+    for (char c : str)
+    {
+      if (write(mMaster, &c, 1) != 1)
+        return;
+      // ~1 ms per byte at 9600 baud
+      std::this_thread::sleep_for(std::chrono::microseconds(1042));
+    }
+  }
+
+  void sayLine(std::string const & str)
+  {
+    say(str + "\r\n");
+  }
+
+  bool readLine(std::string & line)
+  {
+    line.clear();
+    while (!mStop)
+    {
+      struct pollfd pfd = { mMaster, POLLIN, 0 };
+      if (poll(&pfd, 1, 50) <= 0)
+        continue;
+
+      char c;
+      if (read(mMaster, &c, 1) != 1)
+        return false;
+      say(std::string(1, c));   // the board echoes everything
+      if (c == '\n' || c == '\r')
+        return true;
+      line += c;
+    }
+    return false;
+  }
+
+  void run()
+  {
+    std::string line;
+    while (readLine(line))
+    {
+      if (line.empty())
+        continue;
+
+      sayLine("Command Receive: " + line);
+
+      if (line == "wrflgs")
+      {
+        for (int i = 0; i < NUM_FLAGS; i++)
+        {
+          sayLine("Give me a flag to write (don't include wildcat or curly braces)");
+          std::string flag;
+          if (!readLine(flag))
+            return;
+          flag = flag.substr(0, FLAG_MAX_CHARS);
+          if (mCorrupt && i == NUM_FLAGS - 1 && !flag.empty())
+            flag[0] ^= 0x20;
+          mFlags[i] = flag;
+          sayLine("Writing flag " + std::to_string(i) + ": wildcat{" + flag + "}");
+          sayLine("Done");
+        }
+      }
+      else if (line == "wrpins")
+      {
+        for (int i = 0; i < NUM_PINS; i++)
+        {
+          sayLine("Give me a pin to write (no mor than 5 digits)");
+          std::string pin;
+          if (!readLine(pin))
+            return;
+          if (pin.size() < 4 || pin.size() > 5 || pin.find_first_not_of("0123456789") != std::string::npos)
+          {
+            sayLine("Pin code is invalid");
+            continue;
+          }
+          mPins[i] = std::stoul(pin);
+          sayLine("Wrote pin " + pin + " to external RAM");
+        }
+      }
+      else if (line == "setchl")
+      {
+        sayLine("Give me a challenge mode (0-3)");
+        std::string mode;
+        if (!readLine(mode))
+          return;
+        if (mode.size() != 1 || mode[0] < '0' || mode[0] > '3')
+        {
+          sayLine("Invalid challenge mode");
+          continue;
+        }
+        mMode = mode[0] - '0';
+        sayLine("Challenge mode set to " + mode);
+      }
+      else if (line == "getflg")
+      {
+        for (int i = 0; i < NUM_FLAGS; i++)
+          sayLine("Flag " + std::to_string(i) + ": wildcat{" + mFlags[i] + "}");
+        sayLine("Flag 3: wildcat{********}");
+      }
+      else if (line == "getpns")
+      {
+        for (int i = 0; i < NUM_PINS; i++)
+          sayLine("Pin " + std::to_string(i) + ": " + std::to_string(mPins[i] & 0xffff));
+      }
+      else if (line == "ver")
+      {
+        sayLine("DEBUG! " + std::to_string(mMode));
+        sayLine("Flag via serial CLI");
+      }
+      else
+      {
+        sayLine("No matching handler found for command");
+      }
+    }
+  }
+
+  bool mCorrupt;
+  int mMaster = -1;
+  int mSlave = -1;
+  std::string mSlavePath;
+  std::thread mThread;
+  volatile bool mStop = false;
+
+  std::string mFlags[NUM_FLAGS];
+  unsigned long mPins[NUM_PINS] = {};
+  int mMode = 0;
+};
+
+static std::vector<std::string> split(std::string const & str, char sep)
+{
+  std::vector<std::string> out;
+  size_t start = 0;
+  while (true)
+  {
+    size_t p = str.find(sep, start);
+    out.push_back(str.substr(start, p - start));
+    if (p == std::string::npos)
+      break;
+    start = p + 1;
+  }
+  return out;
+}
+
+static std::vector<std::string> discoverPorts()
+{
+  std::vector<std::string> ports;
+  char const * patterns[] = { "/dev/ttyACM*", "/dev/ttyUSB*" };
+  for (char const * pat : patterns)
+  {
+    glob_t g;
+    if (glob(pat, 0, nullptr, &g) == 0)
+    {
+      for (size_t i = 0; i < g.gl_pathc; i++)
+        ports.push_back(g.gl_pathv[i]);
+    }
+    globfree(&g);
+  }
+  return ports;
+}
+
+static void usage(char const * prog)
+{
+  fprintf(stderr,
+    "Usage: %s --flags F0,F1,F2 --pins P0,P1,P2,P3 [--mode 0-3]\n"
+    "          [--ports /dev/ttyACM0,...] [--boot-wait MS] [--timeout MS]\n"
+    "          [--fake N [--fake-bad N]]\n", prog);
+}
+
+int main(int argc, char** argv)
+{
+  ProvisionSpec spec;
+  spec.mode = 0;
+  Options opts;
+  std::vector<std::string> ports;
+  int numFake = 0;
+  int numFakeBad = 0;
+  bool haveFlags = false;
+  bool havePins = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      usage(argv[0]);
+      return 2;
+    }
+    std::string val = argv[++i];
+
+    if (arg == "--flags")
+    {
+      std::vector<std::string> f = split(val, ',');
+      if (f.size() != NUM_FLAGS)
+      {
+        fprintf(stderr, "Need exactly %d flags\n", NUM_FLAGS);
+        return 2;
+      }
+      for (int j = 0; j < NUM_FLAGS; j++)
+      {
+        if (f[j].empty() || f[j].size() > FLAG_MAX_CHARS)
+        {
+          fprintf(stderr, "Flag %d must be 1 to %d chars\n", j, FLAG_MAX_CHARS);
+          return 2;
+        }
+        spec.flags[j] = f[j];
+      }
+      haveFlags = true;
+    }
+    else if (arg == "--pins")
+    {
+      std::vector<std::string> p = split(val, ',');
+      if (p.size() != NUM_PINS)
+      {
+        fprintf(stderr, "Need exactly %d pins\n", NUM_PINS);
+        return 2;
+      }
+      for (int j = 0; j < NUM_PINS; j++)
+      {
+        // setPin on the board checks 4 digit positions, so 3 digit pins fail
+        if (p[j].size() < 4 || p[j].size() > 5 || p[j].find_first_not_of("0123456789") != std::string::npos)
+        {
+          fprintf(stderr, "Pin %d must be 4 or 5 digits\n", j);
+          return 2;
+        }
+        spec.pins[j] = std::stoul(p[j]);
+      }
+      havePins = true;
+    }
+    else if (arg == "--mode")
+      spec.mode = std::atoi(val.c_str()) & 3;
+    else if (arg == "--ports")
+      ports = split(val, ',');
+    else if (arg == "--boot-wait")
+      opts.bootWaitMs = std::atoi(val.c_str());
+    else if (arg == "--timeout")
+      opts.replyTimeoutMs = std::atoi(val.c_str());
+    else if (arg == "--fake")
+      numFake = std::atoi(val.c_str());
+    else if (arg == "--fake-bad")
+      numFakeBad = std::atoi(val.c_str());
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!haveFlags || !havePins)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<std::unique_ptr<FakeBoard>> fakes;
+  if (numFake > 0)
+  {
+    for (int i = 0; i < numFake; i++)
+    {
+      fakes.emplace_back(new FakeBoard(i >= numFake - numFakeBad));
+      if (!fakes.back()->start())
+      {
+        fprintf(stderr, "Couldn't create pty for fake board %d\n", i);
+        return 1;
+      }
+      ports.push_back(fakes.back()->path());
+    }
+    // Fake boards don't reset when opened
+    opts.bootWaitMs = 100;
+  }
+  else if (ports.empty())
+  {
+    ports = discoverPorts();
+  }
+
+  if (ports.empty())
+  {
+    fprintf(stderr, "No serial ports found\n");
+    return 1;
+  }
+
+  printf("Provisioning %zu board(s)\n", ports.size());
+  auto start = Clock::now();
+
+  std::vector<std::future<BoardResult>> workers;
+  for (std::string const & port : ports)
+    workers.push_back(std::async(std::launch::async, provisionBoard, port, std::cref(spec), std::cref(opts)));
+
+  int failures = 0;
+  size_t totalBytes = 0;
+  printf("%-20s %-6s %8s %8s %9s  %s\n", "port", "result", "secs", "bytes", "bytes/s", "error");
+  for (auto & w : workers)
+  {
+    BoardResult r = w.get();
+    size_t bytes = r.bytesTx + r.bytesRx;
+    totalBytes += bytes;
+    failures += r.ok ? 0 : 1;
+    printf("%-20s %-6s %8.2f %8zu %9.0f  %s\n", r.port.c_str(), r.ok ? "OK" : "FAIL", r.seconds,
+           bytes, r.seconds > 0 ? bytes / r.seconds : 0.0, r.error.c_str());
+  }
+
+  double secs = std::chrono::duration<double>(Clock::now() - start).count();
+  printf("%zu board(s) in %.2f s, %zu ok, %d failed, %.0f bytes/s aggregate\n",
+         ports.size(), secs, ports.size() - failures, failures, totalBytes / secs);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+/**************************************************************************
+ Compile-time GPIO for the ATmega328P (Uno / Nano)
+
+ FastPin<N> works out the PORT/PIN/DDR registers and bit mask for Arduino
+ pin N at compile time, so high()/low()/read() compile down to single
+ sbi/cbi/sbic instructions instead of going through digitalWrite's lookup
+ tables and PWM checks.
+
+ FastPinGroup<A, B, ...> reads a set of pins with one access per port and
+ packs them into a mask where bit 0 is pin A, bit 1 is pin B, and so on.
+
+   FastPin<8>::output();
+   FastPin<8>::toggle();
+   uint8_t levels = FastPinGroup<3, 4, 5>::read();
+ **************************************************************************/
+
+#ifndef FAST_PIN_H
+#define FAST_PIN_H
+
+#include <Arduino.h>
+
+// Pins 0-7 are PORTD, 8-13 are PORTB, 14-19 (A0-A5) are PORTC
+#define FAST_PIN_PORT_D 0
+#define FAST_PIN_PORT_B 1
+#define FAST_PIN_PORT_C 2
+
+constexpr uint8_t fastPinPort(uint8_t pin)
+{
+  return (pin < 8) ? FAST_PIN_PORT_D : ( (pin < 14) ? FAST_PIN_PORT_B : FAST_PIN_PORT_C );
+}
+
+constexpr uint8_t fastPinMask(uint8_t pin)
+{
+  return 1 << ( (pin < 8) ? pin : ( (pin < 14) ? pin - 8 : pin - 14 ) );
+}
+
+template <uint8_t PIN>
+struct FastPin
+{
+  static_assert(PIN < 20, "FastPin only knows the ATmega328P pins");
+
+  static constexpr uint8_t port = fastPinPort(PIN);
+  static constexpr uint8_t mask = fastPinMask(PIN);
+
+  static inline volatile uint8_t& outReg()
+  {
+    return (port == FAST_PIN_PORT_D) ? PORTD : ( (port == FAST_PIN_PORT_B) ? PORTB : PORTC );
+  }
+
+  static inline volatile uint8_t& inReg()
+  {
+    return (port == FAST_PIN_PORT_D) ? PIND : ( (port == FAST_PIN_PORT_B) ? PINB : PINC );
+  }
+
+  static inline volatile uint8_t& ddrReg()
+  {
+    return (port == FAST_PIN_PORT_D) ? DDRD : ( (port == FAST_PIN_PORT_B) ? DDRB : DDRC );
+  }
+
+  static inline void output()
+  {
+    ddrReg() |= mask;
+  }
+
+  static inline void input()
+  {
+    ddrReg() &= ~mask;
+    outReg() &= ~mask;
+  }
+
+  static inline void inputPullup()
+  {
+    ddrReg() &= ~mask;
+    outReg() |= mask;
+  }
+
+  static inline void high()
+  {
+    outReg() |= mask;
+  }
+
+  static inline void low()
+  {
+    outReg() &= ~mask;
+  }
+
+  static inline void write(uint8_t val)
+  {
+    if (val)
+    {
+      high();
+    }
+    else
+    {
+      low();
+    }
+  }
+
+  // Writing a 1 to the PINx bit flips the output on the 328P
+  static inline void toggle()
+  {
+    inReg() = mask;
+  }
+
+  static inline uint8_t read()
+  {
+    return (inReg() & mask) ? 1 : 0;
+  }
+};
+
+// Which ports a list of pins touches, as a bitmask of FAST_PIN_PORT_*
+constexpr uint8_t fastPinPortsUsed()
+{
+  return 0;
+}
+
+template <typename... Rest>
+constexpr uint8_t fastPinPortsUsed(uint8_t pin, Rest... rest)
+{
+  return (1 << fastPinPort(pin)) | fastPinPortsUsed(rest...);
+}
+
+template <uint8_t... PINS>
+struct FastPinGroup
+{
+  static constexpr uint8_t portsUsed = fastPinPortsUsed(PINS...);
+
+  static inline void inputPullup()
+  {
+    int expand[] = { 0, (FastPin<PINS>::inputPullup(), 0)... };
+    (void) expand;
+  }
+
+  // One read of each port the group uses, then the bits get packed up
+  static inline uint8_t read()
+  {
+    uint8_t d = (portsUsed & (1 << FAST_PIN_PORT_D)) ? PIND : 0;
+    uint8_t b = (portsUsed & (1 << FAST_PIN_PORT_B)) ? PINB : 0;
+    uint8_t c = (portsUsed & (1 << FAST_PIN_PORT_C)) ? PINC : 0;
+    return pack<0, PINS...>(d, b, c);
+  }
+
+private:
+  template <uint8_t BIT>
+  static inline uint8_t pack(uint8_t, uint8_t, uint8_t)
+  {
+    return 0;
+  }
+
+  template <uint8_t BIT, uint8_t PIN, uint8_t... Rest>
+  static inline uint8_t pack(uint8_t d, uint8_t b, uint8_t c)
+  {
+    uint8_t snap = (fastPinPort(PIN) == FAST_PIN_PORT_D) ? d : ( (fastPinPort(PIN) == FAST_PIN_PORT_B) ? b : c );
+    return ( (snap & fastPinMask(PIN)) ? (1 << BIT) : 0 ) | pack<BIT + 1, Rest...>(d, b, c);
+  }
+};
+
+#endif
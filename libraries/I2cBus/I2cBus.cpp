@@ -0,0 +1,179 @@
+#include "I2cBus.h"
+#include <Wire.h>
+
+// Half an SCL period for recovery, 100 kHz
+#define I2C_RECOVER_HALF_US 5
+
+static struct I2cStats gI2cStats;
+
+void i2cBegin()
+{
+  Wire.begin();
+  Wire.setWireTimeout(I2C_TIMEOUT_US, true);
+}
+
+// Open drain: the pins are only ever driven low or left floating, the bus
+// pull-ups do the rest.  INPUT (not INPUT_PULLUP) leaves PORT at 0, so
+// switching to OUTPUT always pulls low.
+static void i2cLineLow(uint8_t pin)
+{
+  pinMode(pin, OUTPUT);
+}
+
+static void i2cLineRelease(uint8_t pin)
+{
+  pinMode(pin, INPUT);
+}
+
+uint8_t i2cRecover()
+{
+  gI2cStats.recoveries++;
+  Wire.end();
+
+  i2cLineRelease(SDA);
+  i2cLineRelease(SCL);
+  delayMicroseconds(I2C_RECOVER_HALF_US);
+
+  // A device part way through sending a byte lets go of SDA once it has
+  // been clocked through the rest of it and the ack bit
+  for(uint8_t i = 0; (i < 9) && (digitalRead(SDA) == LOW); i++)
+  {
+    i2cLineLow(SCL);
+    delayMicroseconds(I2C_RECOVER_HALF_US);
+    i2cLineRelease(SCL);
+    delayMicroseconds(I2C_RECOVER_HALF_US);
+  }
+
+  // STOP: SDA rising while SCL is high
+  i2cLineLow(SDA);
+  delayMicroseconds(I2C_RECOVER_HALF_US);
+  i2cLineRelease(SDA);
+  delayMicroseconds(I2C_RECOVER_HALF_US);
+
+  uint8_t ok = (digitalRead(SDA) == HIGH) && (digitalRead(SCL) == HIGH);
+
+  i2cBegin();
+  return ok;
+}
+
+static uint8_t i2cTimedOut()
+{
+  if (Wire.getWireTimeoutFlag())
+  {
+    Wire.clearWireTimeoutFlag();
+    return 1;
+  }
+  return 0;
+}
+
+static uint8_t i2cWriteOnce(uint8_t addr, uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  if (Wire.write(buf, len) != len)
+  {
+    // Doesn't fit in Wire's buffer, retrying won't help
+    Wire.endTransmission();
+    return I2C_TOO_LONG;
+  }
+
+  uint8_t status = Wire.endTransmission();
+  return i2cTimedOut() ? I2C_TIMEOUT : status;
+}
+
+static uint8_t i2cReadOnce(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+  Wire.beginTransmission(addr);
+  Wire.write(reg);
+  uint8_t status = Wire.endTransmission();
+  if (i2cTimedOut())
+  {
+    return I2C_TIMEOUT;
+  }
+  if (status != I2C_OK)
+  {
+    return status;
+  }
+
+  uint8_t got = Wire.requestFrom(addr, len);
+  if (i2cTimedOut())
+  {
+    return I2C_TIMEOUT;
+  }
+
+  for(uint8_t i = 0; i < got; i++)
+  {
+    if (Wire.available() == 0)
+    {
+      return I2C_SHORT_READ;
+    }
+    buf[i] = Wire.read();
+  }
+
+  return (got == len) ? I2C_OK : I2C_SHORT_READ;
+}
+
+static uint8_t i2cTransfer(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len, uint8_t isRead)
+{
+  unsigned long start = micros();
+  unsigned int backoffUs = I2C_BACKOFF_US;
+  uint8_t status;
+
+  for(uint8_t tries = 1; ; tries++)
+  {
+    status = isRead ? i2cReadOnce(addr, reg, buf, len) : i2cWriteOnce(addr, reg, buf, len);
+    if ( (status == I2C_OK) || (status == I2C_TOO_LONG) )
+    {
+      break;
+    }
+
+    if ( (status == I2C_TIMEOUT) || (digitalRead(SDA) == LOW) )
+    {
+      i2cRecover();
+    }
+
+    if (tries >= I2C_MAX_TRIES)
+    {
+      break;
+    }
+
+    gI2cStats.retries++;
+    delayMicroseconds(backoffUs);
+    backoffUs <<= 1;
+  }
+
+  if (status != I2C_OK)
+  {
+    gI2cStats.failures++;
+    gI2cStats.lastError = status;
+  }
+
+  gI2cStats.transfers++;
+  gI2cStats.lastUs = micros() - start;
+  if (gI2cStats.lastUs > gI2cStats.maxUs)
+  {
+    gI2cStats.maxUs = gI2cStats.lastUs;
+  }
+
+  return status;
+}
+
+uint8_t i2cWrite(uint8_t addr, uint8_t reg, const uint8_t* buf, uint8_t len)
+{
+  return i2cTransfer(addr, reg, (uint8_t*) buf, len, 0);
+}
+
+uint8_t i2cRead(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+  return i2cTransfer(addr, reg, buf, len, 1);
+}
+
+const struct I2cStats* i2cGetStats()
+{
+  return &gI2cStats;
+}
+
+void i2cResetStats()
+{
+  memset(&gI2cStats, 0, sizeof(gI2cStats));
+}
@@ -0,0 +1,73 @@
+/**************************************************************************
+ I2C register transactions
+
+ Register read / write on top of Wire that never hangs and doesn't give up
+ on the first glitch:
+
+  - every Wire call has a timeout (Wire.setWireTimeout, AVR core 1.8.3+)
+  - failed transfers are retried a bounded number of times, backing off
+    a little longer each time
+  - a timeout or a bus left with SDA held low gets the standard recovery:
+    up to nine SCL clocks until the stuck device lets go of SDA, then a
+    STOP, then Wire is restarted
+
+ Every call's time, retries included, goes into the stats, so the worst
+ case latency a caller can see is i2cGetStats()->maxUs.
+ **************************************************************************/
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <Arduino.h>
+
+// Status codes.  1 - 5 are the same as Wire.endTransmission()'s.
+#define I2C_OK 0
+#define I2C_TOO_LONG 1
+#define I2C_NAK_ADDR 2
+#define I2C_NAK_DATA 3
+#define I2C_OTHER 4
+#define I2C_TIMEOUT 5
+#define I2C_SHORT_READ 6
+
+#ifndef I2C_TIMEOUT_US
+#define I2C_TIMEOUT_US 25000
+#endif
+
+#ifndef I2C_MAX_TRIES
+#define I2C_MAX_TRIES 3
+#endif
+
+// Wait before the first retry, doubles for each one after
+#ifndef I2C_BACKOFF_US
+#define I2C_BACKOFF_US 500
+#endif
+
+struct I2cStats
+{
+  unsigned long transfers;
+  unsigned long lastUs;
+  unsigned long maxUs;     // worst case for one call, retries included
+  uint16_t retries;
+  uint16_t failures;       // calls that still failed after every retry
+  uint16_t recoveries;
+  uint8_t lastError;
+};
+
+// Starts Wire with the timeout set, call instead of Wire.begin()
+void i2cBegin();
+
+// Writes len bytes starting at register reg
+uint8_t i2cWrite(uint8_t addr, uint8_t reg, const uint8_t* buf, uint8_t len);
+
+// Reads len bytes starting at register reg.  Anything short of len is
+// I2C_SHORT_READ, buf is only fully valid on I2C_OK.
+uint8_t i2cRead(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len);
+
+// Clocks a stuck bus free and restarts Wire, returns 1 if both lines are
+// high afterwards
+uint8_t i2cRecover();
+
+const struct I2cStats* i2cGetStats();
+void i2cResetStats();
+
+#endif
@@ -0,0 +1,261 @@
+#include "LedEngine.h"
+#include <avr/interrupt.h>
+
+#define LED_MODE_STEADY 0
+#define LED_MODE_REPEAT 1
+#define LED_MODE_ONESHOT 2
+
+struct LedChannel
+{
+  volatile uint8_t* out;
+  uint8_t mask;
+  uint8_t mode;
+  uint8_t lit;
+  uint16_t onMs;
+  uint16_t offMs;
+  uint16_t remaining;   // ms left in the current phase
+  unsigned long lastToggleUs;
+  int16_t jitterMin;
+  int16_t jitterMax;
+};
+
+static LedChannel gLedChannels[LED_ENGINE_MAX_CHANNELS];
+
+static void ledWrite(LedChannel* c, uint8_t lit)
+{
+  if (c->out == 0)
+  {
+    return;
+  }
+
+  c->lit = lit;
+  if (lit)
+  {
+    *c->out |= c->mask;
+  }
+  else
+  {
+    *c->out &= ~c->mask;
+  }
+}
+
+// Only keep the tick running while something needs it
+static void ledUpdateTick()
+{
+  uint8_t anyTimed = 0;
+  for(uint8_t i = 0; i < LED_ENGINE_MAX_CHANNELS; i++)
+  {
+    if (gLedChannels[i].mode != LED_MODE_STEADY)
+    {
+      anyTimed = 1;
+    }
+  }
+
+  if (anyTimed)
+  {
+    TIMSK2 |= _BV(OCIE2A);
+  }
+  else
+  {
+    TIMSK2 &= ~_BV(OCIE2A);
+  }
+}
+
+static void ledRecordToggle(LedChannel* c, uint16_t phaseMs)
+{
+  unsigned long now = micros();
+  long err = (long) (now - c->lastToggleUs) - (long) phaseMs * 1000;
+  c->lastToggleUs = now;
+
+  err = constrain(err, -32767, 32767);
+  if (err < c->jitterMin)
+  {
+    c->jitterMin = err;
+  }
+  if (err > c->jitterMax)
+  {
+    c->jitterMax = err;
+  }
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+  uint8_t anyTimed = 0;
+
+  for(uint8_t i = 0; i < LED_ENGINE_MAX_CHANNELS; i++)
+  {
+    LedChannel* c = gLedChannels + i;
+    if (c->mode == LED_MODE_STEADY)
+    {
+      continue;
+    }
+
+    anyTimed = 1;
+    if (--c->remaining)
+    {
+      continue;
+    }
+
+    if (c->mode == LED_MODE_ONESHOT)
+    {
+      ledWrite(c, 0);
+      c->mode = LED_MODE_STEADY;
+      continue;
+    }
+
+    uint16_t finishedMs = c->lit ? c->onMs : c->offMs;
+    if (c->lit && c->offMs)
+    {
+      ledWrite(c, 0);
+      c->remaining = c->offMs;
+    }
+    else
+    {
+      ledWrite(c, 1);
+      c->remaining = c->onMs;
+    }
+    ledRecordToggle(c, finishedMs);
+  }
+
+  if (!anyTimed)
+  {
+    TIMSK2 &= ~_BV(OCIE2A);
+  }
+}
+
+void ledBegin()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+
+  // CTC mode, clk/64, 16 MHz / 64 / 250 = 1 kHz
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS22);
+  OCR2A = (F_CPU / 64 / LED_ENGINE_TICK_HZ) - 1;
+  TCNT2 = 0;
+  TIMSK2 &= ~_BV(OCIE2A);
+
+  SREG = oldSREG;
+}
+
+void ledAttach(uint8_t ch, uint8_t pin)
+{
+  if (ch >= LED_ENGINE_MAX_CHANNELS)
+  {
+    return;
+  }
+
+  pinMode(pin, OUTPUT);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  LedChannel* c = gLedChannels + ch;
+  c->out = portOutputRegister(digitalPinToPort(pin));
+  c->mask = digitalPinToBitMask(pin);
+  c->mode = LED_MODE_STEADY;
+  ledWrite(c, 0);
+  ledUpdateTick();
+  SREG = oldSREG;
+
+  ledResetJitter(ch);
+}
+
+static void ledStart(uint8_t ch, uint8_t mode, uint8_t lit, uint16_t onMs, uint16_t offMs)
+{
+  if (ch >= LED_ENGINE_MAX_CHANNELS)
+  {
+    return;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  LedChannel* c = gLedChannels + ch;
+  c->mode = mode;
+  c->onMs = onMs;
+  c->offMs = offMs;
+  c->remaining = onMs;
+  c->lastToggleUs = micros();
+  ledWrite(c, lit);
+  ledUpdateTick();
+  SREG = oldSREG;
+}
+
+void ledOn(uint8_t ch)
+{
+  ledStart(ch, LED_MODE_STEADY, 1, 0, 0);
+}
+
+void ledOff(uint8_t ch)
+{
+  ledStart(ch, LED_MODE_STEADY, 0, 0, 0);
+}
+
+void ledPattern(uint8_t ch, uint16_t onMs, uint16_t offMs)
+{
+  if (onMs == 0)
+  {
+    ledOff(ch);
+    return;
+  }
+
+  ledStart(ch, LED_MODE_REPEAT, 1, onMs, offMs);
+}
+
+void ledBlink(uint8_t ch, uint16_t hz)
+{
+  hz = constrain(hz, 1, 500);
+  uint16_t halfMs = 500 / hz;
+  ledPattern(ch, halfMs, halfMs);
+}
+
+void ledPulse(uint8_t ch, uint16_t onMs, uint16_t periodMs)
+{
+  if (onMs >= periodMs)
+  {
+    ledOn(ch);
+    return;
+  }
+
+  ledPattern(ch, onMs, periodMs - onMs);
+}
+
+void ledOneShot(uint8_t ch, uint16_t onMs)
+{
+  if (onMs == 0)
+  {
+    ledOff(ch);
+    return;
+  }
+
+  ledStart(ch, LED_MODE_ONESHOT, 1, onMs, 0);
+}
+
+void ledGetJitter(uint8_t ch, int16_t* minUs, int16_t* maxUs)
+{
+  if (ch >= LED_ENGINE_MAX_CHANNELS)
+  {
+    *minUs = 0;
+    *maxUs = 0;
+    return;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  *minUs = gLedChannels[ch].jitterMin;
+  *maxUs = gLedChannels[ch].jitterMax;
+  SREG = oldSREG;
+}
+
+void ledResetJitter(uint8_t ch)
+{
+  if (ch >= LED_ENGINE_MAX_CHANNELS)
+  {
+    return;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  gLedChannels[ch].jitterMin = 32767;
+  gLedChannels[ch].jitterMax = -32767;
+  SREG = oldSREG;
+}
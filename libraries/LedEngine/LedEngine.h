@@ -0,0 +1,47 @@
+/**************************************************************************
+ LED pattern engine
+
+ Plays simple LED patterns (on, off, blink, pulse, one-shot) from a 1 kHz
+ Timer2 compare interrupt, so the sketch's loop never has to count time or
+ toggle pins itself.  The tick interrupt is only enabled while at least one
+ channel has a timed pattern running, so steady LEDs cost nothing.
+
+ Timer2 is taken over by this library, so tone() and PWM on pins 3 and 11
+ can't be used alongside it.
+ **************************************************************************/
+
+#ifndef LED_ENGINE_H
+#define LED_ENGINE_H
+
+#include <Arduino.h>
+
+#define LED_ENGINE_MAX_CHANNELS 4
+#define LED_ENGINE_TICK_HZ 1000
+
+// Starts the engine, call once from setup() before any other led function
+void ledBegin();
+
+// Binds a channel to an output pin (sets it as an output and turns it off)
+void ledAttach(uint8_t ch, uint8_t pin);
+
+void ledOn(uint8_t ch);
+void ledOff(uint8_t ch);
+
+// Repeats onMs lit then offMs dark until changed
+void ledPattern(uint8_t ch, uint16_t onMs, uint16_t offMs);
+
+// 50% duty blink at hz (1 - 500)
+void ledBlink(uint8_t ch, uint16_t hz);
+
+// Short flash of onMs at the start of every periodMs
+void ledPulse(uint8_t ch, uint16_t onMs, uint16_t periodMs);
+
+// Lit for onMs, then off for good
+void ledOneShot(uint8_t ch, uint16_t onMs);
+
+// Measured toggle interval error in microseconds since the last reset,
+// positive is late.  Only timed patterns record anything.
+void ledGetJitter(uint8_t ch, int16_t* minUs, int16_t* maxUs);
+void ledResetJitter(uint8_t ch);
+
+#endif
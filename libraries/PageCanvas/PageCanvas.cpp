@@ -0,0 +1,68 @@
+#include "PageCanvas.h"
+
+PageCanvas::PageCanvas(int16_t w, int16_t h)
+  : Adafruit_GFX(w, h), page(0)
+{
+  memset(buffer, 0, sizeof(buffer));
+}
+
+void PageCanvas::setPage(uint8_t p)
+{
+  page = p;
+  memset(buffer, 0, sizeof(buffer));
+}
+
+void PageCanvas::drawPixel(int16_t x, int16_t y, uint16_t color)
+{
+  if ( (x < 0) || (y < 0) || (x >= width()) || (y >= height()) )
+  {
+    return;
+  }
+
+  // Same rotation mapping as Adafruit_SSD1306, so rotated screens look
+  // the same as they did with a full framebuffer
+  int16_t t;
+  switch (getRotation())
+  {
+    case 1:
+      t = x;
+      x = WIDTH - y - 1;
+      y = t;
+      break;
+    case 2:
+      x = WIDTH - x - 1;
+      y = HEIGHT - y - 1;
+      break;
+    case 3:
+      t = x;
+      x = y;
+      y = HEIGHT - t - 1;
+      break;
+  }
+
+  if ( ((uint8_t) y >> 3) != page )
+  {
+    // Some other pass will draw this one
+    return;
+  }
+
+  uint8_t bit = 1 << (y & 7);
+  switch (color)
+  {
+    case PAGE_CANVAS_WHITE:
+      buffer[x] |= bit;
+      break;
+    case PAGE_CANVAS_BLACK:
+      buffer[x] &= ~bit;
+      break;
+    case PAGE_CANVAS_INVERSE:
+      buffer[x] ^= bit;
+      break;
+  }
+}
+
+void PageCanvas::fillScreen(uint16_t color)
+{
+  // Only the current page is backed by memory, so that's all there is to fill
+  memset(buffer, (color == PAGE_CANVAS_WHITE) ? 0xff : 0x00, sizeof(buffer));
+}
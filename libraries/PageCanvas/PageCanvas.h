@@ -0,0 +1,61 @@
+/**************************************************************************
+ Page canvas
+
+ An Adafruit_GFX target that holds a single 8 pixel tall page of a
+ monochrome SSD1306 style screen instead of the whole frame.  A frame is
+ drawn by running the same draw code once per page; every pixel that falls
+ outside the current page is dropped, and after each pass the page buffer
+ is streamed to the panel (the same idea as u8g2's page mode).
+
+ A 128x64 screen costs 128 bytes of RAM this way rather than 1 KB, in
+ exchange for the draw code running 8 times per frame.  Draw code must
+ therefore only draw: anything that reads hardware or changes state should
+ happen once, before the page passes start.
+
+   for (uint8_t page = 0; page < canvas.pageCount(); page++)
+   {
+     canvas.setPage(page);
+     drawFrame();
+     sendPage(page, canvas.getBuffer());
+   }
+ **************************************************************************/
+
+#ifndef PAGE_CANVAS_H
+#define PAGE_CANVAS_H
+
+#include <Arduino.h>
+#include <Adafruit_GFX.h>
+
+// Widest screen the page buffer has room for
+#ifndef PAGE_CANVAS_MAX_WIDTH
+#define PAGE_CANVAS_MAX_WIDTH 128
+#endif
+
+#define PAGE_CANVAS_BLACK 0
+#define PAGE_CANVAS_WHITE 1
+#define PAGE_CANVAS_INVERSE 2
+
+class PageCanvas : public Adafruit_GFX
+{
+public:
+  // w must be no more than PAGE_CANVAS_MAX_WIDTH
+  PageCanvas(int16_t w, int16_t h);
+
+  // Selects the page the next draw pass lands in and clears it
+  void setPage(uint8_t page);
+
+  uint8_t getPage() const { return page; }
+  uint8_t pageCount() const { return (HEIGHT + 7) >> 3; }
+
+  // One byte per column, bit 0 is the top row of the page (SSD1306 order)
+  uint8_t* getBuffer() { return buffer; }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color);
+  void fillScreen(uint16_t color);
+
+private:
+  uint8_t buffer[PAGE_CANVAS_MAX_WIDTH];
+  uint8_t page;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "SerialDiag.h"
+
+#define DIAG_LINE_START 0
+#define DIAG_SENDING    1
+#define DIAG_DROPPING   2   // the whole line, nothing of it has gone out
+#define DIAG_CUT        3   // the rest of the line, but not its end
+
+size_t SerialDiag::write(uint8_t c)
+{
+  int room = mOut.availableForWrite();
+  uint8_t lineEnd = (c == '\n') || (c == '\r');
+
+  if (mState == DIAG_LINE_START)
+  {
+    if (room >= SERIAL_DIAG_ROOM)
+    {
+      mState = DIAG_SENDING;
+    }
+    else
+    {
+      mState = DIAG_DROPPING;
+      mStats.linesDropped++;
+    }
+  }
+  else if ( (mState == DIAG_SENDING) && !lineEnd && (room <= 2) )
+  {
+    // The last two bytes are kept for ending the line
+    mState = DIAG_CUT;
+    mStats.linesCut++;
+  }
+
+  uint8_t send = (mState == DIAG_SENDING) ||
+                 ( (mState == DIAG_CUT) && lineEnd && (room > 0) );
+  if (send)
+  {
+    mOut.write(c);
+  }
+  else
+  {
+    mStats.bytesDropped++;
+  }
+
+  if (c == '\n')
+  {
+    if (mState == DIAG_SENDING)
+    {
+      mStats.lines++;
+    }
+    mState = DIAG_LINE_START;
+  }
+
+  return 1;
+}
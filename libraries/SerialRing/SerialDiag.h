@@ -0,0 +1,61 @@
+/**************************************************************************
+ Best-effort diagnostics on top of a console
+
+ Prints to a SerialDiag go to the Print it wraps only while that Print's
+ transmit buffer has room for them, so chatter such as button echoes or
+ bus dumps never stalls the caller waiting for bytes to drain at 9600
+ baud.  What doesn't fit is thrown away and counted.  Anything that has
+ to arrive (command replies, flags) keeps going to the console itself,
+ which still blocks when its buffer is full.
+
+ Whole lines are kept or dropped: a line is only started with at least
+ SERIAL_DIAG_ROOM bytes free, and one that runs out of room partway is
+ cut short but still ended, so what does arrive stays one message per
+ line.
+
+   SerialDiag Diag(Console);
+
+   Diag.println(F("Up"));
+ **************************************************************************/
+
+#ifndef SERIAL_DIAG_H
+#define SERIAL_DIAG_H
+
+#include <Arduino.h>
+
+// Free transmit buffer needed to start a line, so most lines go out whole.
+// Change it with a build flag, like the ring sizes in SerialRing.h.
+#ifndef SERIAL_DIAG_ROOM
+#define SERIAL_DIAG_ROOM 40
+#endif
+
+struct SerialDiagStats
+{
+  unsigned long bytesDropped;  // every byte thrown away
+  uint16_t lines;              // lines sent whole
+  uint16_t linesDropped;       // lines not started, the buffer was full
+  uint16_t linesCut;           // lines that ran out of room partway
+};
+
+class SerialDiag : public Print
+{
+public:
+  SerialDiag(Print& out) : mOut(out), mState(0), mStats() {}
+
+  // Always claims the byte was written, so a print carries on to the line
+  // end even when the start of the line was dropped
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  int availableForWrite() override { return mOut.availableForWrite(); }
+
+  void getStats(struct SerialDiagStats* out) { *out = mStats; }
+  void resetStats() { memset(&mStats, 0, sizeof(mStats)); }
+
+private:
+  Print& mOut;
+  uint8_t mState;
+  struct SerialDiagStats mStats;
+};
+
+#endif
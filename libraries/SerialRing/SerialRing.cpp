@@ -0,0 +1,296 @@
+#include "SerialRing.h"
+#include <avr/interrupt.h>
+
+#if (SERIAL_RX_RING_LEN & (SERIAL_RX_RING_LEN - 1)) || (SERIAL_RX_RING_LEN > 256)
+#error SERIAL_RX_RING_LEN must be a power of two, 256 at most
+#endif
+
+#if (SERIAL_TX_RING_LEN & (SERIAL_TX_RING_LEN - 1)) || (SERIAL_TX_RING_LEN > 256)
+#error SERIAL_TX_RING_LEN must be a power of two, 256 at most
+#endif
+
+#define SERIAL_RX_MASK (SERIAL_RX_RING_LEN - 1)
+#define SERIAL_TX_MASK (SERIAL_TX_RING_LEN - 1)
+
+SerialRing Console;
+SerialDiag Diag(Console);
+
+// head is only written by whoever fills a ring and tail by whoever empties
+// it, and both are single bytes, so neither side needs to lock to read them
+static uint8_t gRxBuf[SERIAL_RX_RING_LEN];
+static volatile uint8_t gRxHead;
+static volatile uint8_t gRxTail;
+static volatile uint8_t gRxLines;
+static uint8_t gRxLosing;
+static struct SerialRxStats gRxStats;
+
+static uint8_t gTxBuf[SERIAL_TX_RING_LEN];
+static volatile uint8_t gTxHead;
+static volatile uint8_t gTxTail;
+static uint8_t gTxUsed;
+static struct SerialTxStats gTxStats;
+
+static uint8_t serialIsLineEnd(uint8_t c)
+{
+  return (c == '\n') || (c == '\r');
+}
+
+static void serialRxPut(uint8_t c)
+{
+  gRxBuf[gRxHead] = c;
+  gRxHead = (gRxHead + 1) & SERIAL_RX_MASK;
+}
+
+ISR(USART_RX_vect)
+{
+  // Status has to be read before the data register pops the byte
+  uint8_t status = UCSR0A;
+  uint8_t c = UDR0;
+
+  gRxStats.bytes++;
+  if (status & _BV(DOR0))
+  {
+    // A byte before this one is gone, so the line it was in is damaged
+    // even though this byte is good
+    gRxStats.overruns++;
+    gRxLosing = 1;
+  }
+  if (status & _BV(FE0))
+  {
+    // Usually a break or a baud rate mismatch, the byte is noise and the
+    // line it was part of is missing it
+    gRxStats.frameErrors++;
+    gRxLosing = 1;
+    return;
+  }
+
+  uint8_t used = (gRxHead - gRxTail) & SERIAL_RX_MASK;
+  uint8_t room = SERIAL_RX_MASK - used;
+
+  if (serialIsLineEnd(c))
+  {
+    if (gRxLosing)
+    {
+      if (room < 2)
+      {
+        gRxStats.dropped++;
+        return;
+      }
+      serialRxPut(SERIAL_LINE_LOST);
+      gRxLosing = 0;
+      gRxStats.linesLost++;
+    }
+    else if (room == 0)
+    {
+      gRxStats.dropped++;
+      gRxLosing = 1;
+      return;
+    }
+
+    serialRxPut(c);
+    gRxLines++;
+  }
+  else if (gRxLosing || (room <= 2))
+  {
+    // The last two slots are kept for ending the line, lost or not
+    gRxStats.dropped++;
+    gRxLosing = 1;
+    return;
+  }
+  else
+  {
+    serialRxPut(c);
+  }
+
+  if (used + 1 > gRxStats.peak)
+  {
+    gRxStats.peak = used + 1;
+  }
+}
+
+static void serialTxNext()
+{
+  uint8_t c = gTxBuf[gTxTail];
+  gTxTail = (gTxTail + 1) & SERIAL_TX_MASK;
+
+  UDR0 = c;
+  // Writing TXC0 clears it, so flush() can tell when this byte is out
+  UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+
+  if (gTxHead == gTxTail)
+  {
+    UCSR0B &= ~_BV(UDRIE0);
+  }
+}
+
+ISR(USART_UDRE_vect)
+{
+  serialTxNext();
+}
+
+void SerialRing::begin(unsigned long baud)
+{
+  // Double speed halves the rounding error, except at 57600 on a 16 MHz
+  // board where the old bootloaders expect it off (same as the core)
+  uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+  uint8_t u2x = _BV(U2X0);
+  if ( ( (F_CPU == 16000000UL) && (baud == 57600) ) || (ubrr > 4095) )
+  {
+    ubrr = (F_CPU / 8 / baud - 1) / 2;
+    u2x = 0;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+
+  gRxHead = gRxTail = 0;
+  gRxLines = 0;
+  gRxLosing = 0;
+  gTxHead = gTxTail = 0;
+  gTxUsed = 0;
+
+  UCSR0A = u2x;
+  UBRR0H = ubrr >> 8;
+  UBRR0L = ubrr;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);   // 8N1
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+
+  SREG = oldSREG;
+}
+
+void SerialRing::end()
+{
+  flush();
+  UCSR0B &= ~(_BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0) | _BV(UDRIE0));
+  gRxHead = gRxTail = 0;
+  gRxLines = 0;
+}
+
+int SerialRing::available()
+{
+  return (gRxHead - gRxTail) & SERIAL_RX_MASK;
+}
+
+int SerialRing::peek()
+{
+  if (gRxHead == gRxTail)
+  {
+    return -1;
+  }
+  return gRxBuf[gRxTail];
+}
+
+int SerialRing::read()
+{
+  if (gRxHead == gRxTail)
+  {
+    return -1;
+  }
+
+  uint8_t c = gRxBuf[gRxTail];
+  gRxTail = (gRxTail + 1) & SERIAL_RX_MASK;
+
+  if (serialIsLineEnd(c))
+  {
+    uint8_t oldSREG = SREG;
+    cli();
+    gRxLines--;
+    SREG = oldSREG;
+  }
+  return c;
+}
+
+int SerialRing::availableForWrite()
+{
+  return (gTxTail - gTxHead - 1) & SERIAL_TX_MASK;
+}
+
+void SerialRing::flush()
+{
+  if (!gTxUsed)
+  {
+    // TXC0 is never set if nothing has been sent
+    return;
+  }
+
+  while ( (UCSR0B & _BV(UDRIE0)) || !(UCSR0A & _BV(TXC0)) )
+  {
+    if ( !(SREG & _BV(SREG_I)) && (UCSR0A & _BV(UDRE0)) && (UCSR0B & _BV(UDRIE0)) )
+    {
+      // Interrupts are off, so do the interrupt's job
+      serialTxNext();
+    }
+  }
+}
+
+size_t SerialRing::write(uint8_t c)
+{
+  gTxUsed = 1;
+  gTxStats.bytes++;
+
+  // Nothing queued and the data register free: straight out, the ring
+  // and interrupt only cost time here
+  if ( (gTxHead == gTxTail) && (UCSR0A & _BV(UDRE0)) )
+  {
+    uint8_t oldSREG = SREG;
+    cli();
+    UDR0 = c;
+    UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+    SREG = oldSREG;
+    return 1;
+  }
+
+  uint8_t next = (gTxHead + 1) & SERIAL_TX_MASK;
+  if (next == gTxTail)
+  {
+    gTxStats.stalls++;
+  }
+  while (next == gTxTail)
+  {
+    // Full, wait for the interrupt to make room (or make it ourselves)
+    if ( !(SREG & _BV(SREG_I)) && (UCSR0A & _BV(UDRE0)) )
+    {
+      serialTxNext();
+    }
+  }
+
+  gTxBuf[gTxHead] = c;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  gTxHead = next;
+  UCSR0B |= _BV(UDRIE0);
+  SREG = oldSREG;
+
+  return 1;
+}
+
+uint8_t serialLines()
+{
+  return gRxLines;
+}
+
+void serialGetStats(struct SerialRxStats* out)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  *out = gRxStats;
+  SREG = oldSREG;
+}
+
+// Only write() touches these, never an interrupt
+void serialGetTxStats(struct SerialTxStats* out)
+{
+  *out = gTxStats;
+}
+
+void serialResetStats()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  memset(&gRxStats, 0, sizeof(gRxStats));
+  SREG = oldSREG;
+
+  memset(&gTxStats, 0, sizeof(gTxStats));
+  Diag.resetStats();
+}
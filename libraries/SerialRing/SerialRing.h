@@ -0,0 +1,97 @@
+/**************************************************************************
+ Interrupt driven console UART
+
+ A replacement for the core's Serial on USART0 with a receive ring big
+ enough to ride out the sketch's blocking sections (a 5 s delay, a
+ display flush) at 9600 baud, and counters for everything it had to
+ throw away, so lost input is never silent.
+
+ The receive interrupt also keeps track of lines: it counts complete
+ lines waiting in the ring, so the main loop can tell a whole command is
+ there without scanning for it.  Once a line has lost a byte (the ring
+ was full, the UART overran, or the byte arrived with a framing error)
+ the rest of that line is dropped too, and the line is ended with
+ SERIAL_LINE_LOST then the line end.  A reader that sees SERIAL_LINE_LOST
+ knows the line it is assembling is missing bytes and shouldn't be acted
+ on.
+
+ USART0 is taken over by this library, so the core's Serial can't be used
+ alongside it (its interrupt vectors would clash).  It is a Stream like
+ Serial, so a sketch switches over with:
+
+   #define Serial Console
+
+ Writes to Console wait for room when the transmit ring is full, so they
+ always arrive.  Diag (SerialDiag.h) is the same port for output that
+ can be lost instead: it drops what doesn't fit and counts it.
+ **************************************************************************/
+
+#ifndef SERIAL_RING_H
+#define SERIAL_RING_H
+
+#include <Arduino.h>
+#include "SerialDiag.h"
+
+// Sizes are powers of two, 256 at most.  One slot of each always stays
+// empty, and the receive ring keeps two more back for ending a line.
+// Change them with a build flag (build_firmware.sh -DSERIAL_RX_RING_LEN=128),
+// a #define in the sketch doesn't reach this library's .cpp.
+#ifndef SERIAL_RX_RING_LEN
+#define SERIAL_RX_RING_LEN 256
+#endif
+
+#ifndef SERIAL_TX_RING_LEN
+#define SERIAL_TX_RING_LEN 64
+#endif
+
+// ASCII CAN, ends a line the receive ring had to drop bytes from
+#define SERIAL_LINE_LOST 0x18
+
+struct SerialRxStats
+{
+  unsigned long bytes;     // received, good or bad
+  uint16_t dropped;        // thrown away, the ring was full
+  uint16_t linesLost;      // lines ended with SERIAL_LINE_LOST
+  uint16_t overruns;       // the UART lost a byte before we got to it
+  uint16_t frameErrors;    // bad stop bit, the byte is thrown away
+  uint8_t peak;            // most bytes ever waiting in the ring
+};
+
+struct SerialTxStats
+{
+  unsigned long bytes;     // queued or sent by write()
+  unsigned long stalls;    // writes that had to wait for the ring to drain
+};
+
+class SerialRing : public Stream
+{
+public:
+  void begin(unsigned long baud);
+  void end();
+
+  int available() override;
+  int peek() override;
+  int read() override;
+
+  int availableForWrite() override;
+  void flush() override;
+  size_t write(uint8_t c) override;
+  using Print::write;
+
+  operator bool() { return true; }
+};
+
+extern SerialRing Console;
+extern SerialDiag Diag;
+
+// Complete lines (ended by \r or \n) waiting to be read
+uint8_t serialLines();
+
+// Copied out with interrupts off, the receive interrupt updates them
+void serialGetStats(struct SerialRxStats* out);
+void serialGetTxStats(struct SerialTxStats* out);
+
+// Clears the receive, transmit and Diag counters
+void serialResetStats();
+
+#endif
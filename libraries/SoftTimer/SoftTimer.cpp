@@ -0,0 +1,109 @@
+#include "SoftTimer.h"
+
+// Host builds that step several timer queues from several threads define
+// this as thread_local
+#ifndef SOFT_TIMER_LOCAL
+#define SOFT_TIMER_LOCAL
+#endif
+
+static SoftTimerQueue gDefaultQueue;
+static SOFT_TIMER_LOCAL SoftTimerQueue* gQueue = &gDefaultQueue;
+
+// millis() wraps after ~49 days, so compare by difference
+static inline uint8_t timerBefore(unsigned long a, unsigned long b)
+{
+  return (long) (a - b) < 0;
+}
+
+static void timerUnlink(SoftTimer* t)
+{
+  SoftTimer** link = &gQueue->head;
+  while (*link)
+  {
+    if (*link == t)
+    {
+      *link = t->next;
+      break;
+    }
+    link = &(*link)->next;
+  }
+  t->next = 0;
+  t->armed = 0;
+}
+
+static void timerInsert(SoftTimer* t)
+{
+  // Timers due at the same time fire in the order they were armed
+  SoftTimer** link = &gQueue->head;
+  while (*link && !timerBefore(t->due, (*link)->due))
+  {
+    link = &(*link)->next;
+  }
+  t->next = *link;
+  *link = t;
+  t->armed = 1;
+}
+
+static void timerArm(SoftTimer* t, uint16_t ms, uint16_t periodMs, void (*callback)())
+{
+  if (t->armed)
+  {
+    timerUnlink(t);
+  }
+
+  t->due = millis() + ms;
+  t->periodMs = periodMs;
+  t->callback = callback;
+  timerInsert(t);
+}
+
+void timerUseQueue(SoftTimerQueue* q)
+{
+  gQueue = q ? q : &gDefaultQueue;
+}
+
+void timerOnce(SoftTimer* t, uint16_t ms, void (*callback)())
+{
+  timerArm(t, ms, 0, callback);
+}
+
+void timerEvery(SoftTimer* t, uint16_t ms, void (*callback)())
+{
+  timerArm(t, ms, ms, callback);
+}
+
+void timerStop(SoftTimer* t)
+{
+  if (t->armed)
+  {
+    timerUnlink(t);
+  }
+}
+
+void timerService()
+{
+  unsigned long now = millis();
+
+  while (gQueue->head && !timerBefore(now, gQueue->head->due))
+  {
+    SoftTimer* t = gQueue->head;
+    gQueue->head = t->next;
+    t->next = 0;
+    t->armed = 0;
+
+    if (t->periodMs)
+    {
+      // Stay on the original schedule so periods don't drift, unless the
+      // loop fell a whole period behind, then don't try to catch up
+      t->due += t->periodMs;
+      if (!timerBefore(now, t->due))
+      {
+        t->due = now + t->periodMs;
+      }
+      timerInsert(t);
+    }
+
+    // Last, so the callback sees the timer's new state and can change it
+    t->callback();
+  }
+}
@@ -0,0 +1,66 @@
+/**************************************************************************
+ Software timers
+
+ Millisecond one-shot and periodic timers that fire their callbacks from
+ the main loop, so nothing has to count loop passes or compare millis()
+ by hand.  Armed timers are kept in a list sorted by due time, so
+ timerService() only ever looks at the head, and a timer that isn't armed
+ isn't in the list and costs nothing.
+
+ The caller owns the SoftTimer storage (usually a global):
+
+   SoftTimer gBlinkTimer;
+
+   timerEvery(&gBlinkTimer, 500, toggleLed);
+   ...
+   while (1)
+   {
+     timerService();
+     ...
+   }
+
+ Callbacks run inside timerService() and may start or stop any timer,
+ including their own.
+
+ There is one queue of armed timers unless the caller sets up more, e.g.
+ to run several independent copies of a program in one process: give
+ each copy a SoftTimerQueue and switch to it with timerUseQueue() before
+ any of its timers are touched.
+ **************************************************************************/
+
+#ifndef SOFT_TIMER_H
+#define SOFT_TIMER_H
+
+#include <Arduino.h>
+
+struct SoftTimer
+{
+  SoftTimer* next;
+  unsigned long due;
+  uint16_t periodMs;   // 0 for a one-shot
+  uint8_t armed;
+  void (*callback)();
+};
+
+struct SoftTimerQueue
+{
+  SoftTimer* head;
+};
+
+// Makes q the queue the other calls work on, 0 for the default one
+void timerUseQueue(SoftTimerQueue* q);
+
+// Fires once, ms from now.  Restarts the timer if it's already armed.
+void timerOnce(SoftTimer* t, uint16_t ms, void (*callback)());
+
+// Fires every ms, the first time ms from now
+void timerEvery(SoftTimer* t, uint16_t ms, void (*callback)());
+
+void timerStop(SoftTimer* t);
+
+inline uint8_t timerArmed(const SoftTimer* t) { return t->armed; }
+
+// Runs the callback of every timer that has come due, call from the main loop
+void timerService();
+
+#endif
@@ -0,0 +1,120 @@
+#include "TinyFmt.h"
+
+char* fmtDec32(char* buf, uint32_t val)
+{
+  // Build it backwards in a scratch buffer, then copy forwards
+  char tmp[FMT_DEC32_LEN];
+  uint8_t len = 0;
+  do
+  {
+    tmp[len++] = '0' + (val % 10);
+    val /= 10;
+  } while (val);
+
+  while (len)
+  {
+    *buf++ = tmp[--len];
+  }
+  *buf = 0;
+  return buf;
+}
+
+char* fmtDec(char* buf, uint16_t val)
+{
+  // 16-bit division is a lot cheaper than 32-bit on AVR
+  char tmp[5];
+  uint8_t len = 0;
+  do
+  {
+    tmp[len++] = '0' + (val % 10);
+    val /= 10;
+  } while (val);
+
+  while (len)
+  {
+    *buf++ = tmp[--len];
+  }
+  *buf = 0;
+  return buf;
+}
+
+char* fmtSigned(char* buf, int16_t val)
+{
+  if (val < 0)
+  {
+    *buf++ = '-';
+    return fmtDec(buf, -(int32_t) val);
+  }
+  return fmtDec(buf, val);
+}
+
+static char hexDigit(uint8_t nibble)
+{
+  return (nibble >= 10) ? ('a' + nibble - 10) : ('0' + nibble);
+}
+
+char* fmtHex8(char* buf, uint8_t val)
+{
+  buf[0] = hexDigit(val >> 4);
+  buf[1] = hexDigit(val & 0xf);
+  buf[2] = 0;
+  return buf + 2;
+}
+
+char* fmtBcd(char* buf, uint8_t bcd)
+{
+  buf[0] = '0' + (bcd >> 4);
+  buf[1] = '0' + (bcd & 0xf);
+  buf[2] = 0;
+  return buf + 2;
+}
+
+char* fmtStr_P(char* buf, const char* pgmStr)
+{
+  strcpy_P(buf, pgmStr);
+  return buf + strlen(buf);
+}
+
+uint32_t parseDec(const char* str)
+{
+  uint32_t val = 0;
+  while ( (*str >= '0') && (*str <= '9') )
+  {
+    val = val * 10 + (*str++ - '0');
+  }
+  return val;
+}
+
+static int8_t hexValue(char c)
+{
+  if ( (c >= '0') && (c <= '9') )
+  {
+    return c - '0';
+  }
+  if ( (c >= 'a') && (c <= 'f') )
+  {
+    return c - 'a' + 10;
+  }
+  if ( (c >= 'A') && (c <= 'F') )
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+int16_t parseHex8(const char* str)
+{
+  int8_t hi = hexValue(str[0]);
+  if (hi < 0)
+  {
+    return -1;
+  }
+
+  int8_t lo = hexValue(str[1]);
+  if (lo < 0)
+  {
+    return -1;
+  }
+
+  return (hi << 4) | lo;
+}
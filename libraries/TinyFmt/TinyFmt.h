@@ -0,0 +1,40 @@
+/**************************************************************************
+ Tiny integer formatting
+
+ Small replacements for sprintf("%d") / strtoul so a sketch doesn't have to
+ link in the whole printf / strtol machinery.  Every fmt function writes
+ into the caller's buffer, null terminates, and returns a pointer to the
+ terminator so calls can be chained:
+
+   char buf[10];
+   fmtDec(fmtStr_P(buf, PSTR("Ver 1.")), mode);
+ **************************************************************************/
+
+#ifndef TINY_FMT_H
+#define TINY_FMT_H
+
+#include <Arduino.h>
+
+// Longest output of fmtDec32 plus the terminator
+#define FMT_DEC32_LEN 11
+
+char* fmtDec(char* buf, uint16_t val);
+char* fmtDec32(char* buf, uint32_t val);
+char* fmtSigned(char* buf, int16_t val);
+
+// Two lowercase hex digits
+char* fmtHex8(char* buf, uint8_t val);
+
+// Two digits from a packed BCD byte (DS1307 time registers)
+char* fmtBcd(char* buf, uint8_t bcd);
+
+// Copies a PROGMEM string
+char* fmtStr_P(char* buf, const char* pgmStr);
+
+// Leading decimal digits of str, stops at the first non-digit
+uint32_t parseDec(const char* str);
+
+// Two hex digits (either case), -1 if they aren't both hex
+int16_t parseHex8(const char* str);
+
+#endif